@@ -0,0 +1,320 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+
+#include "debug.h"
+#include "epics.h"
+
+// Microbenchmark of epics_read_packet() over a synthetic corpus of CA
+// datagrams, one CSV line per corpus and filter configuration.
+
+#define BENCH_DATAGRAMS       4096      // Datagrams per corpus
+#define BENCH_DATAGRAM_MAX    1024      // CA clients fill up to ~1 kB
+#define BENCH_TIME_MS         200       // Minimum run per configuration
+#define BENCH_MAX_RULES       1000
+
+extern const char* EPICS_RELAY_GIT_REV;
+extern const char* EPICS_RELAY_GIT_VERSION;
+
+struct bench_datagram {
+  int len;
+  int pvs;
+  char data[BENCH_DATAGRAM_MAX];
+};
+
+struct bench_corpus {
+  const char *name;
+  int num;
+  int pvs;
+  struct bench_datagram *datagram;
+};
+
+static const char *bench_area[] = {"OP", "ES", "VA", "DI", "BI", "CT"};
+static const char *bench_device[] = {"Mir", "Slt", "Mono", "DCM", "BPM",
+                                     "Cam", "GV", "IP", "TC", "Shtr"};
+static const char *bench_field[] = {"", ".RBV", ".VAL", ".DMOV", ".STAT",
+                                    ".SEVR", ".DESC", ".EGU"};
+
+static double bench_random(void) {
+  return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+static int bench_skewed(int n) {
+  // Squaring a uniform number favours low indexes, a few beamlines and
+  // devices see most of the searches as in production
+  double u = bench_random();
+  return (int)(u * u * n);
+}
+
+static int bench_pv_name(char *name, int size) {
+  int sector = 2 + bench_skewed(30);
+  return snprintf(name, size, "XF:%02d%s%c-%s{%s:%d-Ax:%c}%s%s", sector,
+                  bench_random() < 0.7 ? "ID" : "BM",
+                  'A' + bench_skewed(4),
+                  bench_area[bench_skewed(6)],
+                  bench_device[bench_skewed(10)],
+                  1 + bench_skewed(8),
+                  "XYZPR"[bench_skewed(5)],
+                  bench_random() < 0.6 ? "Mtr" : "Pos",
+                  bench_field[bench_skewed(8)]);
+}
+
+static void bench_build(struct bench_datagram *d, const char *kind,
+                        uint32_t id) {
+  char name[EPICS_PV_MAX_LEN];
+  int len = 0;
+
+  d->pvs = 0;
+  if (!strcmp(kind, "beacon")) {
+    len = epics_write_beacon(d->data, BENCH_DATAGRAM_MAX,
+                             EPICS_CA_SERVER_PORT, id,
+                             0x0a000001 + (id & 0xff));
+  } else if (!strcmp(kind, "single")) {
+    int name_len = bench_pv_name(name, sizeof(name));
+    len = epics_write_search(d->data, BENCH_DATAGRAM_MAX, name, name_len, id);
+    d->pvs = 1;
+  } else {
+    // Multi search fills a datagram, mixed is what a client sends on
+    // start up, a version and a handful of searches
+    int num = !strcmp(kind, "mixed") ? 1 + bench_skewed(8) : 1000;
+    if (!strcmp(kind, "mixed")) {
+      len = epics_write_version(d->data, BENCH_DATAGRAM_MAX);
+    }
+    for (int i = 0; i < num; i++) {
+      int name_len = bench_pv_name(name, sizeof(name));
+      int _len = epics_write_search(d->data + len, BENCH_DATAGRAM_MAX - len,
+                                    name, name_len, id * 64 + i);
+      if (!_len) {
+        break;
+      }
+      len += _len;
+      d->pvs++;
+    }
+  }
+
+  d->len = len;
+}
+
+static int bench_corpus(struct bench_corpus *corpus, const char *kind,
+                        int num) {
+  corpus->name = kind;
+  corpus->num = num;
+  corpus->pvs = 0;
+  corpus->datagram = malloc(num * sizeof(struct bench_datagram));
+  if (!corpus->datagram) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return -1;
+  }
+
+  for (int i = 0; i < num; i++) {
+    bench_build(&(corpus->datagram[i]), kind, i);
+    corpus->pvs += corpus->datagram[i].pvs;
+  }
+
+  return 0;
+}
+
+static int bench_filter(struct epics_pv_filter *filter, int rules,
+                        int sense, int logic) {
+  char exp[128];
+
+  filter->sense = sense;
+  filter->logic = logic;
+  filter->next = NULL;
+
+  // Rules in the style of a facility filter list, most of them miss
+  for (int i = 0; i < rules; i++) {
+    switch (i % 4) {
+    case 0:
+      snprintf(exp, sizeof(exp), "^XF:%02dID%c-%s", 2 + (i / 4) % 30,
+               'A' + (i / 120) % 4, bench_area[(i / 4) % 6]);
+      break;
+    case 1:
+      snprintf(exp, sizeof(exp), "^XF:%02dBM.*\\{%s:%d", 2 + (i / 4) % 30,
+               bench_device[(i / 4) % 10], 1 + (i / 40) % 8);
+      break;
+    case 2:
+      snprintf(exp, sizeof(exp), "%s:%d-Ax:[%c-Z]\\}Mtr\\.RBV$",
+               bench_device[(i / 4) % 10], 1 + (i / 40) % 8,
+               'P' + (i / 4) % 10);
+      break;
+    default:
+      snprintf(exp, sizeof(exp), "^TEST%d:", i);
+      break;
+    }
+    if (epics_filter_insert(filter, exp)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static double bench_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void bench_run(FILE *out, const char *label,
+                      struct bench_corpus *corpus,
+                      struct epics_pv_filter *filter, int rules,
+                      int time_ms) {
+  static char dest[BENCH_DATAGRAM_MAX];
+  long datagrams = 0;
+  long pvs = 0;
+  long bytes = 0;
+
+  // One untimed pass to warm up caches and the match data
+  for (int i = 0; i < corpus->num; i++) {
+    struct bench_datagram *d = &(corpus->datagram[i]);
+    epics_read_packet(dest, d->data, d->len, filter);
+  }
+
+  double start = bench_now();
+  double elapsed;
+  do {
+    for (int i = 0; i < corpus->num; i++) {
+      struct bench_datagram *d = &(corpus->datagram[i]);
+      bytes += epics_read_packet(dest, d->data, d->len, filter);
+    }
+    datagrams += corpus->num;
+    pvs += corpus->pvs;
+    elapsed = bench_now() - start;
+  } while (elapsed < time_ms * 1e6);
+
+  fprintf(out, "%s,%s,%d,%d,%d,%ld,%ld,%.1f,%.1f,%.3f,%.0f\n", label,
+          corpus->name, rules, filter->sense, filter->logic, datagrams,
+          pvs, elapsed / datagrams, pvs ? elapsed / pvs : 0.0,
+          (double)bytes / datagrams, datagrams * 1e9 / elapsed);
+  fflush(out);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-l label] [-t ms] [-n datagrams] [-s seed] "
+          "[-o file]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  const char *label = EPICS_RELAY_GIT_VERSION;
+  const char *output = NULL;
+  int time_ms = BENCH_TIME_MS;
+  int num = BENCH_DATAGRAMS;
+  unsigned int seed = 1;
+  int c;
+
+  while ((c = getopt(argc, argv, "l:t:n:s:o:h")) != -1) {
+    switch (c) {
+    case 'l':
+      label = optarg;
+      break;
+    case 't':
+      time_ms = atoi(optarg);
+      break;
+    case 'n':
+      num = atoi(optarg);
+      break;
+    case 's':
+      seed = strtoul(optarg, NULL, 0);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return (c == 'h') ? 0 : -1;
+    }
+  }
+
+  if ((time_ms <= 0) || (num <= 0)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  FILE *out = stdout;
+  if (output && !(out = fopen(output, "w"))) {
+    ERROR_PRINT("Unable to open %s\n", output);
+    return -1;
+  }
+
+  // The same seed gives the same corpus so builds can be compared
+  srand(seed);
+  static const char *kinds[] = {"single", "multi", "beacon", "mixed"};
+  struct bench_corpus corpus[4];
+  for (int i = 0; i < 4; i++) {
+    if (bench_corpus(&(corpus[i]), kinds[i], num)) {
+      return -1;
+    }
+  }
+
+  fprintf(out, "label,corpus,rules,sense,logic,datagrams,pvs,"
+          "ns_per_datagram,ns_per_pv,bytes_out_per_datagram,datagrams_per_s\n");
+
+  static const int rules[] = {0, 10, 100, BENCH_MAX_RULES};
+  for (int r = 0; r < 4; r++) {
+    // Sense and logic make no difference without rules
+    int combos = rules[r] ? 4 : 1;
+    for (int k = 0; k < combos; k++) {
+      struct epics_pv_filter filter;
+      if (bench_filter(&filter, rules[r], k & 1, (k >> 1) & 1)) {
+        ERROR_COMMENT("Unable to build filter\n");
+        return -1;
+      }
+      for (int i = 0; i < 4; i++) {
+        bench_run(out, label, &(corpus[i]), &filter, rules[r], time_ms);
+      }
+      epics_filter_free(&filter);
+    }
+  }
+
+  for (int i = 0; i < 4; i++) {
+    free(corpus[i].datagram);
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  return 0;
+}
@@ -0,0 +1,272 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "epics.h"
+#include "histogram.h"
+
+// Traffic source and sink for the end to end harness. The sender
+// broadcasts CA searches, and now and then a beacon, at a fixed rate.
+// Each search carries its send time in the two CID fields so the sink
+// can measure the latency through the relay.
+
+#define E2E_DATAGRAM_MAX      1024
+#define E2E_TICK_NS           100000    // Pacing interval of the sender
+#define E2E_IDLE_S            1         // Sink stops after this long idle
+
+static uint64_t e2e_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int e2e_search(char *dest, uint32_t seq, int num) {
+  char name[EPICS_PV_MAX_LEN];
+  int len = 0;
+
+  for (int i = 0; i < num; i++) {
+    struct ca_proto_search *msg = (struct ca_proto_search *)(dest + len);
+    int name_len = snprintf(name, sizeof(name), "E2E:LOAD:%u:%d", seq, i);
+    int _len = epics_write_search(dest + len, E2E_DATAGRAM_MAX - len, name,
+                                  name_len, 0);
+    if (!_len) {
+      break;
+    }
+
+    // Send time straight across cid1 and cid2, only the sink reads it
+    uint64_t now = e2e_now();
+    memcpy(&(msg->cid1), &now, sizeof(now));
+    len += _len;
+  }
+
+  return len;
+}
+
+static int e2e_send(const char *address, int port, int rate, int seconds,
+                    int beacon, int num) {
+  char data[E2E_DATAGRAM_MAX];
+  struct sockaddr_in addr;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (!inet_aton(address, &(addr.sin_addr))) {
+    fprintf(stderr, "Invalid address %s\n", address);
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int enable = 1;
+  if ((fd < 0) ||
+      setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable))) {
+    perror("socket");
+    return -1;
+  }
+
+  uint64_t start = e2e_now();
+  uint64_t end = start + (uint64_t)seconds * 1000000000;
+  uint64_t sent = 0, failed = 0;
+  uint32_t seq = 0;
+
+  for (uint64_t now = start; now < end; now = e2e_now()) {
+    // Catch up to where the rate says we should be, then sleep a tick
+    uint64_t due = (now - start) * rate / 1000000000;
+    while (sent + failed < due) {
+      int len = (beacon && !(seq % beacon)) ?
+        epics_write_beacon(data, sizeof(data), EPICS_CA_SERVER_PORT, seq, 0) :
+        e2e_search(data, seq, num);
+      if (sendto(fd, data, len, 0, (struct sockaddr *)&addr,
+                 sizeof(addr)) < 0) {
+        failed++;
+      } else {
+        sent++;
+      }
+      seq++;
+    }
+
+    struct timespec tick = {0, E2E_TICK_NS};
+    nanosleep(&tick, NULL);
+  }
+
+  double elapsed = (e2e_now() - start) * 1e-9;
+  printf("offered=%d sent=%lu failed=%lu seconds=%.3f\n", rate,
+         (unsigned long)sent, (unsigned long)failed, elapsed);
+  close(fd);
+  return 0;
+}
+
+static int e2e_sink(int port, int seconds) {
+  static struct histogram latency;
+  char data[E2E_DATAGRAM_MAX];
+  struct sockaddr_in addr;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int enable = 1;
+  if ((fd < 0) ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) ||
+      setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable)) ||
+      bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    perror("socket");
+    return -1;
+  }
+
+  struct timeval timeout = {0, 100000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  uint64_t start = e2e_now();
+  uint64_t end = start + (uint64_t)seconds * 1000000000;
+  uint64_t last = 0;
+  uint64_t datagrams = 0, searches = 0, beacons = 0;
+
+  for (uint64_t now = start; now < end; now = e2e_now()) {
+    if (last && (now - last > (uint64_t)E2E_IDLE_S * 1000000000)) {
+      break;
+    }
+
+    ssize_t len = recv(fd, data, sizeof(data), 0);
+    if (len <= 0) {
+      continue;
+    }
+    now = e2e_now();
+    last = now;
+    datagrams++;
+
+    for (ssize_t pos = 0;
+         pos + (ssize_t)sizeof(struct ca_proto_msg) <= len;) {
+      struct ca_proto_msg *msg = (struct ca_proto_msg *)(data + pos);
+      if (htons(msg->command) == CA_PROTO_SEARCH) {
+        uint64_t sent;
+        memcpy(&sent, &(msg->param1), sizeof(sent));
+        histogram_record(&latency, (now > sent) ? now - sent : 0);
+        searches++;
+      } else if (htons(msg->command) == CA_PROTO_RSRV_IS_UP) {
+        beacons++;
+      }
+      pos += sizeof(struct ca_proto_msg) + htons(msg->payload_size);
+    }
+  }
+
+  printf("datagrams=%lu searches=%lu beacons=%lu p50_us=%.1f p90_us=%.1f "
+         "p99_us=%.1f max_us=%.1f\n", (unsigned long)datagrams,
+         (unsigned long)searches, (unsigned long)beacons,
+         histogram_percentile(&latency, 50.0) * 1e-3,
+         histogram_percentile(&latency, 90.0) * 1e-3,
+         histogram_percentile(&latency, 99.0) * 1e-3,
+         histogram_max(&latency) * 1e-3);
+  close(fd);
+  return 0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s send [-a address] [-p port] [-r rate] [-d seconds] "
+          "[-b beacon_every] [-n searches]\n"
+          "       %s sink [-p port] [-d seconds]\n", name, name);
+}
+
+int main(int argc, char *argv[]) {
+  const char *address = "255.255.255.255";
+  int port = EPICS_CA_SERVER_PORT;
+  int rate = 1000;
+  int seconds = 5;
+  int beacon = 10;
+  int num = 1;
+  int c;
+
+  if (argc < 2) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  optind = 2;
+  while ((c = getopt(argc, argv, "a:p:r:d:b:n:")) != -1) {
+    switch (c) {
+    case 'a':
+      address = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    case 'd':
+      seconds = atoi(optarg);
+      break;
+    case 'b':
+      beacon = atoi(optarg);
+      break;
+    case 'n':
+      num = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if ((rate <= 0) || (seconds <= 0) || (num <= 0) ||
+      (num * 40 > E2E_DATAGRAM_MAX)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  if (!strcmp(argv[1], "send")) {
+    return e2e_send(address, port, rate, seconds, beacon, num);
+  } else if (!strcmp(argv[1], "sink")) {
+    return e2e_sink(port, seconds);
+  }
+
+  usage(argv[0]);
+  return -1;
+}
@@ -0,0 +1,181 @@
+#!/bin/bash
+#
+#  epics-relay
+#
+#  Stuart B. Wilkins, Brookhaven National Laboratory
+#
+#
+#  BSD 3-Clause License
+#
+#  Copyright (c) 2021, Brookhaven Science Associates
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#
+#  1. Redistributions of source code must retain the above copyright notice,
+#     this list of conditions and the following disclaimer.
+#
+#  2. Redistributions in binary form must reproduce the above copyright notice,
+#     this list of conditions and the following disclaimer in the documentation
+#     and/or other materials provided with the distribution.
+#
+#  3. Neither the name of the copyright holder nor the names of its
+#     contributors may be used to endorse or promote products derived from
+#     this software without specific prior written permission.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+#  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+#  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+#  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+#  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+#  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+#  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+#  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+#  THE POSSIBILITY OF SUCH DAMAGE.
+#
+# End to end throughput harness. Builds four network namespaces joined
+# by veth pairs,
+#
+#   e2e_client  c0 10.201.1.2 --- c1 10.201.1.1  e2e_collector
+#   e2e_collector  r0 10.201.2.1 --- r1 10.201.2.2  e2e_emitter
+#   e2e_emitter  s1 10.201.3.1 --- s0 10.201.3.2  e2e_sink
+#
+# runs the collector and emitter between them and drives searches and
+# beacons from the client at increasing rates. For each rate a line of
+# CSV gives the delivered rate, the loss and the latency at the sink.
+#
+# Usage: e2e.sh [-b build_dir] [-r "rates"] [-d seconds] [-n searches]
+#               [-o output.csv]
+#
+# Needs root for the namespaces and for the raw socket of the emitter,
+# exits with 77 (skipped) without it.
+
+set -e
+
+BUILD=$(pwd)
+RATES="1000 2000 5000 10000 20000 50000 100000 200000"
+DURATION=5
+SEARCHES=1
+OUTPUT=e2e.csv
+
+while getopts "b:r:d:n:o:h" opt; do
+  case ${opt} in
+    b) BUILD=${OPTARG} ;;
+    r) RATES=${OPTARG} ;;
+    d) DURATION=${OPTARG} ;;
+    n) SEARCHES=${OPTARG} ;;
+    o) OUTPUT=${OPTARG} ;;
+    *) sed -n '/^# Usage/,/^#$/p' "$0" >&2; exit 1 ;;
+  esac
+done
+
+if [ "$(id -u)" -ne 0 ]; then
+  echo "Needs root for network namespaces, skipping" >&2
+  exit 77
+fi
+
+for bin in epics_udp_collector epics_udp_emitter epics_relay_e2e; do
+  if [ ! -x "${BUILD}/${bin}" ]; then
+    echo "${BUILD}/${bin} not found, build it first" >&2
+    exit 1
+  fi
+done
+
+WORK=$(mktemp -d)
+NS="e2e_client e2e_collector e2e_emitter e2e_sink"
+
+cleanup() {
+  for pid in ${COLLECTOR} ${EMITTER}; do
+    kill "${pid}" 2>/dev/null || true
+  done
+  wait 2>/dev/null || true
+  for ns in ${NS}; do
+    ip netns del "${ns}" 2>/dev/null || true
+  done
+  echo "Logs in ${WORK}" >&2
+}
+trap cleanup EXIT
+
+veth() {
+  # veth <ns_a> <if_a> <addr_a> <ns_b> <if_b> <addr_b>
+  ip link add "$2" netns "$1" type veth peer name "$5" netns "$4"
+  ip -n "$1" addr add "$3/24" brd + dev "$2"
+  ip -n "$4" addr add "$6/24" brd + dev "$5"
+  ip -n "$1" link set "$2" up
+  ip -n "$4" link set "$5" up
+}
+
+for ns in ${NS}; do
+  ip netns add "${ns}"
+  ip -n "${ns}" link set lo up
+done
+
+veth e2e_client c0 10.201.1.2 e2e_collector c1 10.201.1.1
+veth e2e_collector r0 10.201.2.1 e2e_emitter r1 10.201.2.2
+veth e2e_emitter s1 10.201.3.1 e2e_sink s0 10.201.3.2
+
+# Broadcasts keep the client source address, which is not routable
+# from the sink
+ip netns exec e2e_sink sysctl -qw net.ipv4.conf.all.rp_filter=0
+ip netns exec e2e_sink sysctl -qw net.ipv4.conf.s0.rp_filter=0
+
+cat > "${WORK}/collector.conf" <<CONF
+collector = {
+  interface = "r0"
+  epics_interface = "c1"
+  emitter = ( { hostname = "10.201.2.2" } )
+}
+CONF
+
+cat > "${WORK}/emitter.conf" <<CONF
+emitter = {
+  interface = "r1"
+  epics_interface = "s1"
+}
+CONF
+
+ip netns exec e2e_collector "${BUILD}/epics_udp_collector" \
+  -c "${WORK}/collector.conf" > "${WORK}/collector.log" 2>&1 &
+COLLECTOR=$!
+ip netns exec e2e_emitter "${BUILD}/epics_udp_emitter" \
+  -c "${WORK}/emitter.conf" > "${WORK}/emitter.log" 2>&1 &
+EMITTER=$!
+sleep 1
+
+echo "offered,sent,datagrams,searches,beacons,delivered_per_s,loss_pct,"\
+"p50_us,p90_us,p99_us,max_us" > "${OUTPUT}"
+
+value() {
+  # value <key> <line>
+  echo "$2" | tr ' ' '\n' | sed -n "s/^$1=//p"
+}
+
+for rate in ${RATES}; do
+  ip netns exec e2e_sink "${BUILD}/epics_relay_e2e" sink \
+    -d $((DURATION + 5)) > "${WORK}/sink.out" &
+  SINK=$!
+  sleep 0.2
+
+  SENT=$(ip netns exec e2e_client "${BUILD}/epics_relay_e2e" send \
+    -a 10.201.1.255 -r "${rate}" -d "${DURATION}" -n "${SEARCHES}")
+  wait ${SINK}
+  RECV=$(cat "${WORK}/sink.out")
+
+  sent=$(value sent "${SENT}")
+  seconds=$(value seconds "${SENT}")
+  datagrams=$(value datagrams "${RECV}")
+  awk -v rate="${rate}" -v sent="${sent}" -v s="${seconds}" \
+      -v d="${datagrams}" -v recv="${RECV}" 'BEGIN {
+    n = split(recv, kv, /[ =]/)
+    for (i = 1; i < n; i += 2) v[kv[i]] = kv[i + 1]
+    loss = sent ? 100.0 * (sent - d) / sent : 0
+    # No sender line (it failed) gives no duration and no rate
+    delivered = (s > 0) ? d / s : 0
+    printf "%d,%d,%d,%d,%d,%.0f,%.2f,%s,%s,%s,%s\n", rate, sent, d,
+      v["searches"], v["beacons"], delivered, loss < 0 ? 0 : loss,
+      v["p50_us"], v["p90_us"], v["p99_us"], v["max_us"]
+  }' | tee -a "${OUTPUT}"
+done
@@ -0,0 +1,658 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "epics.h"
+#include "proto.h"
+#include "histogram.h"
+
+// Synthetic CA traffic for load testing the relay. "clients" simulates
+// many CA clients, each searching for its channels with the backoff of
+// libca until an IOC answers. "iocs" simulates many IOCs sending
+// beacons and answering searches for the PVs they own. PV names come
+// from a population shared by both sides through the seed, and whether
+// a PV exists is decided from a hash of its name, so a fraction of the
+// channels is never found and keeps being searched for, as in
+// production.
+
+#define LOADGEN_DATAGRAM_MAX    1024        // libca sends searches up to this
+#define LOADGEN_TICK_NS         1000000
+#define LOADGEN_SEARCH_MIN_NS   32000000    // First retry of a search
+#define LOADGEN_SEARCH_MAX      300         // EPICS_CA_MAX_SEARCH_PERIOD
+#define LOADGEN_BEACON_MIN_NS   20000000    // First beacon after a boot
+#define LOADGEN_BEACON_PERIOD   15          // EPICS_CA_BEACON_PERIOD
+#define LOADGEN_IOC_PORT        10000       // TCP port of the first IOC
+#define LOADGEN_RCVBUF          4194304     // Do not lose our own replies
+
+struct loadgen_channel {
+  uint32_t pv;                // Index into the population
+  uint32_t resolved;
+  uint64_t first;             // Time of the first search
+  uint64_t next;
+  uint64_t period;
+};
+
+struct loadgen_client {
+  uint64_t start;
+  uint64_t next;              // Next search of any of its channels
+  int pending;
+};
+
+struct loadgen_ioc {
+  uint64_t next;
+  uint64_t interval;
+  uint32_t beaconid;
+};
+
+struct loadgen_config {
+  const char *address;
+  const char *listen;
+  int port;
+  int seconds;
+  int ramp;
+  uint64_t seed;
+  int population;
+  int skew;
+  int clients;
+  int channels;
+  int max_period;
+  int iocs;
+  int owned;
+  int beacon_period;
+  int verbose;
+};
+
+static const char *loadgen_area[] = {"OP", "ES", "VA", "DI", "BI", "CT"};
+static const char *loadgen_device[] = {"Mir", "Slt", "Mono", "DCM", "BPM",
+                                       "Cam", "GV", "IP", "TC", "Shtr"};
+static const char *loadgen_field[] = {"", ".RBV", ".VAL", ".DMOV", ".STAT",
+                                      ".SEVR", ".DESC", ".EGU"};
+
+static uint64_t loadgen_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint64_t loadgen_mix(uint64_t x) {
+  // splitmix64, a good enough hash of the seed and an index
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+static double loadgen_random(uint64_t *state) {
+  *state = loadgen_mix(*state);
+  return (*state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int loadgen_pick(uint64_t *state, int n) {
+  return (int)(loadgen_random(state) * n);
+}
+
+static int loadgen_pv_name(const struct loadgen_config *config,
+                           uint32_t pv, char *name, int size) {
+  uint64_t state = config->seed ^ ((uint64_t)pv << 32);
+  int sector = 2 + loadgen_pick(&state, 30);
+  return snprintf(name, size, "XF:%02d%s%c-%s{%s:%d-Ax:%c}%s%s", sector,
+                  loadgen_random(&state) < 0.7 ? "ID" : "BM",
+                  'A' + loadgen_pick(&state, 4),
+                  loadgen_area[loadgen_pick(&state, 6)],
+                  loadgen_device[loadgen_pick(&state, 10)],
+                  1 + loadgen_pick(&state, 8),
+                  "XYZPR"[loadgen_pick(&state, 5)],
+                  loadgen_random(&state) < 0.6 ? "Mtr" : "Pos",
+                  loadgen_field[loadgen_pick(&state, 8)]);
+}
+
+static uint32_t loadgen_hash(const char *name, int len) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// Returns the IOC owning the PV, -1 if it does not exist
+static int loadgen_owner(const struct loadgen_config *config,
+                         const char *name, int len) {
+  uint32_t hash = loadgen_hash(name, len);
+  if ((int)(hash % 100) >= config->owned) {
+    return -1;
+  }
+  return (hash / 100) % config->iocs;
+}
+
+static int loadgen_socket(const char *address, int port, int reuse) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (!inet_aton(address, &(addr.sin_addr))) {
+    fprintf(stderr, "Invalid address %s\n", address);
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int enable = 1;
+  if ((fd < 0) ||
+      setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable)) ||
+      (reuse && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable,
+                           sizeof(enable))) ||
+      bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      fcntl(fd, F_SETFL, O_NONBLOCK)) {
+    perror("socket");
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  // Best effort, the kernel caps it at net.core.rmem_max
+  int size = LOADGEN_RCVBUF;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  return fd;
+}
+
+static void loadgen_wait(int fd, uint64_t now, uint64_t next) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  int timeout = 0;
+  if (next > now) {
+    timeout = (next - now + 999999) / 1000000;
+  }
+  poll(&pfd, 1, timeout);
+}
+
+static uint32_t loadgen_choose(const struct loadgen_config *config,
+                               uint64_t *state) {
+  // A power of a uniform number favours low indexes, a few PVs are
+  // searched for by many clients as in production
+  double u = loadgen_random(state);
+  double x = 1.0;
+  for (int i = 0; i < config->skew; i++) {
+    x *= u;
+  }
+  return (uint32_t)(x * config->population);
+}
+
+static void loadgen_client_send(const struct loadgen_config *config,
+                                int fd, struct sockaddr_in *dest,
+                                struct loadgen_client *client,
+                                struct loadgen_channel *channel,
+                                uint32_t cid, uint64_t now,
+                                uint64_t *datagrams, uint64_t *searches) {
+  char data[LOADGEN_DATAGRAM_MAX];
+  char name[EPICS_PV_MAX_LEN];
+  uint64_t max_period = (uint64_t)config->max_period * 1000000000;
+  int len = epics_write_version(data, sizeof(data));
+  int num = 0;
+
+  client->next = UINT64_MAX;
+  for (int i = 0; i < config->channels; i++) {
+    struct loadgen_channel *ch = &(channel[i]);
+    if (ch->resolved) {
+      continue;
+    }
+
+    if (ch->next <= now) {
+      int name_len = loadgen_pv_name(config, ch->pv, name, sizeof(name));
+      int _len = epics_write_search(data + len, sizeof(data) - len, name,
+                                    name_len, cid + i);
+      if (!_len) {
+        // Datagram is full, send it and start the next one
+        if (sendto(fd, data, len, 0, (struct sockaddr *)dest,
+                   sizeof(*dest)) >= 0) {
+          (*datagrams)++;
+          *searches += num;
+        }
+        len = epics_write_version(data, sizeof(data));
+        num = 0;
+        _len = epics_write_search(data + len, sizeof(data) - len, name,
+                                  name_len, cid + i);
+      }
+      len += _len;
+      num++;
+
+      // Retries back off exponentially up to the maximum period
+      if (!ch->first) {
+        ch->first = now;
+        ch->period = LOADGEN_SEARCH_MIN_NS;
+      } else if (ch->period < max_period) {
+        ch->period = (ch->period * 2 < max_period) ?
+                     ch->period * 2 : max_period;
+      }
+      ch->next = now + ch->period;
+    }
+
+    if (ch->next < client->next) {
+      client->next = ch->next;
+    }
+  }
+
+  if (num && (sendto(fd, data, len, 0, (struct sockaddr *)dest,
+                     sizeof(*dest)) >= 0)) {
+    (*datagrams)++;
+    *searches += num;
+  }
+}
+
+static int loadgen_clients(const struct loadgen_config *config) {
+  static struct histogram connect;
+  struct sockaddr_in dest;
+  char data[PROTO_BUF_SIZE];
+  uint64_t state = config->seed;
+
+  memset(&dest, 0, sizeof(dest));
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons(config->port);
+  if (!inet_aton(config->address, &(dest.sin_addr))) {
+    fprintf(stderr, "Invalid address %s\n", config->address);
+    return -1;
+  }
+
+  int fd = loadgen_socket(config->listen, 0, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  int num = config->clients * config->channels;
+  struct loadgen_client *client = calloc(config->clients,
+                                         sizeof(struct loadgen_client));
+  struct loadgen_channel *channel = calloc(num,
+                                           sizeof(struct loadgen_channel));
+  if (!client || !channel) {
+    fprintf(stderr, "Unable to allocate memory\n");
+    return -1;
+  }
+
+  // Clients connect spread over the ramp, all at once without one
+  uint64_t start = loadgen_now();
+  for (int i = 0; i < config->clients; i++) {
+    client[i].start = start + (uint64_t)(loadgen_random(&state) *
+                                         config->ramp * 1e9);
+    client[i].next = client[i].start;
+    client[i].pending = config->channels;
+    for (int j = 0; j < config->channels; j++) {
+      struct loadgen_channel *ch = &(channel[i * config->channels + j]);
+      ch->pv = loadgen_choose(config, &state);
+      ch->next = client[i].start;
+    }
+  }
+
+  uint64_t end = start + (uint64_t)config->seconds * 1000000000;
+  uint64_t report = start + 1000000000;
+  uint64_t datagrams = 0, searches = 0, replies = 0, resolved = 0;
+  uint64_t _datagrams = 0, _searches = 0, _replies = 0;
+
+  if (config->verbose) {
+    printf("second,datagrams,searches,replies,resolved,pending\n");
+  }
+
+  for (uint64_t now = start; now < end; now = loadgen_now()) {
+    uint64_t next = now + LOADGEN_TICK_NS;
+
+    for (int i = 0; i < config->clients; i++) {
+      if (client[i].pending && (client[i].next <= now)) {
+        loadgen_client_send(config, fd, &dest, &(client[i]),
+                            &(channel[i * config->channels]),
+                            i * config->channels, now,
+                            &datagrams, &searches);
+      }
+    }
+
+    // Replies carry the CID of the channel in param2
+    ssize_t len;
+    while ((len = recv(fd, data, sizeof(data), 0)) > 0) {
+      now = loadgen_now();
+      for (ssize_t pos = 0;
+           pos + (ssize_t)sizeof(struct ca_proto_msg) <= len;) {
+        struct ca_proto_msg *msg = (struct ca_proto_msg *)(data + pos);
+        uint32_t cid = ntohl(msg->param2);
+        if ((ntohs(msg->command) == CA_PROTO_SEARCH) &&
+            (cid < (uint32_t)num)) {
+          replies++;
+          struct loadgen_channel *ch = &(channel[cid]);
+          if (!ch->resolved) {
+            ch->resolved = 1;
+            client[cid / config->channels].pending--;
+            histogram_record(&connect, now - ch->first);
+            resolved++;
+          }
+        }
+        pos += sizeof(struct ca_proto_msg) + ntohs(msg->payload_size);
+      }
+    }
+
+    now = loadgen_now();
+    if (config->verbose && (now >= report)) {
+      printf("%lu,%lu,%lu,%lu,%lu,%lu\n",
+             (unsigned long)((report - start) / 1000000000),
+             (unsigned long)(datagrams - _datagrams),
+             (unsigned long)(searches - _searches),
+             (unsigned long)(replies - _replies),
+             (unsigned long)resolved, (unsigned long)(num - resolved));
+      fflush(stdout);
+      _datagrams = datagrams;
+      _searches = searches;
+      _replies = replies;
+      report += 1000000000;
+    }
+
+    loadgen_wait(fd, now, next);
+  }
+
+  double elapsed = (loadgen_now() - start) * 1e-9;
+  printf("clients=%d channels=%d datagrams=%lu searches=%lu replies=%lu "
+         "resolved=%lu pending=%lu seconds=%.3f connect_p50_ms=%.1f "
+         "connect_p99_ms=%.1f\n", config->clients, num,
+         (unsigned long)datagrams, (unsigned long)searches,
+         (unsigned long)replies, (unsigned long)resolved,
+         (unsigned long)(num - resolved), elapsed,
+         histogram_percentile(&connect, 50.0) * 1e-6,
+         histogram_percentile(&connect, 99.0) * 1e-6);
+
+  close(fd);
+  free(client);
+  free(channel);
+  return 0;
+}
+
+static int loadgen_reply(char *dest, int ioc, uint32_t cid) {
+  int len = epics_write_version(dest, LOADGEN_DATAGRAM_MAX);
+  struct ca_proto_msg *msg = (struct ca_proto_msg *)(dest + len);
+
+  // Server address of all ones tells the client to use the source
+  memset(msg, 0, sizeof(*msg) + 8);
+  msg->command = htons(CA_PROTO_SEARCH);
+  msg->payload_size = htons(8);
+  msg->data = htons(LOADGEN_IOC_PORT + ioc);
+  msg->param1 = htonl(INADDR_BROADCAST);
+  msg->param2 = htonl(cid);
+  *(uint16_t *)(dest + len + sizeof(*msg)) = htons(CA_MINOR_VERSION);
+
+  return len + sizeof(*msg) + 8;
+}
+
+static int loadgen_iocs(const struct loadgen_config *config) {
+  struct sockaddr_in dest, src;
+  char data[PROTO_BUF_SIZE];
+  char reply[LOADGEN_DATAGRAM_MAX];
+  uint64_t state = config->seed;
+
+  memset(&dest, 0, sizeof(dest));
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons(EPICS_CA_REPEATER_PORT);
+  if (!inet_aton(config->address, &(dest.sin_addr))) {
+    fprintf(stderr, "Invalid address %s\n", config->address);
+    return -1;
+  }
+
+  int fd = loadgen_socket(config->listen, config->port, 1);
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct loadgen_ioc *ioc = calloc(config->iocs, sizeof(struct loadgen_ioc));
+  if (!ioc) {
+    fprintf(stderr, "Unable to allocate memory\n");
+    return -1;
+  }
+
+  // Booting IOCs beacon quickly, then slow down to the beacon period
+  uint64_t start = loadgen_now();
+  uint64_t period = (uint64_t)config->beacon_period * 1000000000;
+  for (int i = 0; i < config->iocs; i++) {
+    ioc[i].next = start + (uint64_t)(loadgen_random(&state) *
+                                     config->ramp * 1e9);
+    ioc[i].interval = LOADGEN_BEACON_MIN_NS;
+  }
+
+  uint64_t end = start + (uint64_t)config->seconds * 1000000000;
+  uint64_t report = start + 1000000000;
+  uint64_t beacons = 0, requests = 0, searches = 0, replies = 0;
+  uint64_t _beacons = 0, _searches = 0, _replies = 0;
+
+  if (config->verbose) {
+    printf("second,beacons,searches,replies\n");
+  }
+
+  for (uint64_t now = start; now < end; now = loadgen_now()) {
+    uint64_t next = now + LOADGEN_TICK_NS;
+
+    for (int i = 0; i < config->iocs; i++) {
+      if (ioc[i].next > now) {
+        continue;
+      }
+
+      int len = epics_write_beacon(reply, sizeof(reply), LOADGEN_IOC_PORT + i,
+                                   ioc[i].beaconid++, 0);
+      if (sendto(fd, reply, len, 0, (struct sockaddr *)&dest,
+                 sizeof(dest)) >= 0) {
+        beacons++;
+      }
+
+      ioc[i].next = now + ioc[i].interval;
+      if (ioc[i].interval < period) {
+        ioc[i].interval = (ioc[i].interval * 2 < period) ?
+                          ioc[i].interval * 2 : period;
+      }
+    }
+
+    // Each owning IOC answers a search on its own
+    socklen_t src_len = sizeof(src);
+    ssize_t len;
+    while ((len = recvfrom(fd, data, sizeof(data), 0,
+                           (struct sockaddr *)&src, &src_len)) > 0) {
+      requests++;
+      for (ssize_t pos = 0;
+           pos + (ssize_t)sizeof(struct ca_proto_msg) <= len;) {
+        struct ca_proto_search *msg = (struct ca_proto_search *)(data + pos);
+        int payload = ntohs(msg->payload_size);
+        if (pos + (ssize_t)sizeof(*msg) + payload > len) {
+          break;
+        }
+
+        if (ntohs(msg->command) == CA_PROTO_SEARCH) {
+          const char *name = data + pos + sizeof(*msg);
+          int owner = loadgen_owner(config, name, strnlen(name, payload));
+          searches++;
+          if ((owner >= 0) &&
+              (sendto(fd, reply, loadgen_reply(reply, owner,
+                                               ntohl(msg->cid1)), 0,
+                      (struct sockaddr *)&src, src_len) >= 0)) {
+            replies++;
+          }
+        }
+        pos += sizeof(*msg) + payload;
+      }
+      src_len = sizeof(src);
+    }
+
+    now = loadgen_now();
+    if (config->verbose && (now >= report)) {
+      printf("%lu,%lu,%lu,%lu\n",
+             (unsigned long)((report - start) / 1000000000),
+             (unsigned long)(beacons - _beacons),
+             (unsigned long)(searches - _searches),
+             (unsigned long)(replies - _replies));
+      fflush(stdout);
+      _beacons = beacons;
+      _searches = searches;
+      _replies = replies;
+      report += 1000000000;
+    }
+
+    loadgen_wait(fd, now, next);
+  }
+
+  printf("iocs=%d beacons=%lu datagrams=%lu searches=%lu replies=%lu "
+         "seconds=%.3f\n", config->iocs, (unsigned long)beacons,
+         (unsigned long)requests, (unsigned long)searches,
+         (unsigned long)replies, (loadgen_now() - start) * 1e-9);
+
+  close(fd);
+  free(ioc);
+  return 0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s clients [-a address] [-p port] [-l listen] "
+          "[-c clients] [-n channels]\n"
+          "               [-m max_period] [common options]\n"
+          "       %s iocs [-a address] [-p port] [-l listen] [-i iocs] "
+          "[-b beacon_period]\n"
+          "               [common options]\n"
+          "common options: [-N population] [-k skew] [-o owned_percent] "
+          "[-r ramp]\n"
+          "                [-d seconds] [-s seed] [-v]\n", name, name);
+}
+
+int main(int argc, char *argv[]) {
+  struct loadgen_config config;
+  int c;
+
+  config.address = "255.255.255.255";
+  config.listen = "0.0.0.0";
+  config.port = EPICS_CA_SERVER_PORT;
+  config.seconds = 30;
+  config.ramp = 0;
+  config.seed = 1;
+  config.population = 100000;
+  config.skew = 2;
+  config.clients = 1000;
+  config.channels = 20;
+  config.max_period = LOADGEN_SEARCH_MAX;
+  config.iocs = 100;
+  config.owned = 80;
+  config.beacon_period = LOADGEN_BEACON_PERIOD;
+  config.verbose = 0;
+
+  if (argc < 2) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  optind = 2;
+  while ((c = getopt(argc, argv, "a:p:l:c:n:m:i:b:N:k:o:r:d:s:v")) != -1) {
+    switch (c) {
+    case 'a':
+      config.address = optarg;
+      break;
+    case 'p':
+      config.port = atoi(optarg);
+      break;
+    case 'l':
+      config.listen = optarg;
+      break;
+    case 'c':
+      config.clients = atoi(optarg);
+      break;
+    case 'n':
+      config.channels = atoi(optarg);
+      break;
+    case 'm':
+      config.max_period = atoi(optarg);
+      break;
+    case 'i':
+      config.iocs = atoi(optarg);
+      break;
+    case 'b':
+      config.beacon_period = atoi(optarg);
+      break;
+    case 'N':
+      config.population = atoi(optarg);
+      break;
+    case 'k':
+      config.skew = atoi(optarg);
+      break;
+    case 'o':
+      config.owned = atoi(optarg);
+      break;
+    case 'r':
+      config.ramp = atoi(optarg);
+      break;
+    case 'd':
+      config.seconds = atoi(optarg);
+      break;
+    case 's':
+      config.seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'v':
+      config.verbose = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if ((config.seconds <= 0) || (config.ramp < 0) ||
+      (config.population <= 0) || (config.skew < 1) ||
+      (config.clients <= 0) || (config.channels <= 0) ||
+      (((uint64_t)config.clients * config.channels) > INT32_MAX) ||
+      (config.max_period <= 0) || (config.iocs <= 0) ||
+      (config.owned < 0) || (config.owned > 100) ||
+      (config.beacon_period <= 0)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  if (!strcmp(argv[1], "clients")) {
+    return loadgen_clients(&config);
+  } else if (!strcmp(argv[1], "iocs")) {
+    return loadgen_iocs(&config);
+  }
+
+  usage(argv[0]);
+  return -1;
+}
@@ -0,0 +1,217 @@
+#!/bin/bash
+#
+#  epics-relay
+#
+#  Stuart B. Wilkins, Brookhaven National Laboratory
+#
+#
+#  BSD 3-Clause License
+#
+#  Copyright (c) 2021, Brookhaven Science Associates
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#
+#  1. Redistributions of source code must retain the above copyright notice,
+#     this list of conditions and the following disclaimer.
+#
+#  2. Redistributions in binary form must reproduce the above copyright notice,
+#     this list of conditions and the following disclaimer in the documentation
+#     and/or other materials provided with the distribution.
+#
+#  3. Neither the name of the copyright holder nor the names of its
+#     contributors may be used to endorse or promote products derived from
+#     this software without specific prior written permission.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+#  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+#  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+#  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+#  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+#  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+#  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+#  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+#  THE POSSIBILITY OF SUCH DAMAGE.
+#
+#
+# Performance regression check. Compares a results CSV from the
+# benchmark or the end to end harness against the baseline of the
+# gating host and fails when a metric falls outside its tolerance
+# band. Each baseline line is
+#
+#   test,key,metric,better,value,tolerance_pct
+#
+# where key selects the results row as column=value pairs joined by
+# ";", metric is a column of the results and better is "higher" or
+# "lower". With a command after "--" it is run first to produce the
+# results, a command exiting with 77 skips the check. A missing
+# baseline, or one without lines for the test, fails the check.
+#
+# -u writes the measured values into the baseline instead of checking.
+# When the baseline has no lines for the test, or does not exist, they
+# are created from the results: -k names the key columns and each
+# -m metric:better:tolerance_pct a metric to record.
+#
+# Usage: perfcheck.sh -t test -b baseline.csv -r results.csv [-u]
+#                     [-k col,col...] [-m metric:better:pct ...]
+#                     [-- command ...]
+
+set -e
+
+TEST=
+BASELINE=
+RESULTS=
+UPDATE=0
+KEYS=
+METRICS=
+
+while getopts "t:b:r:k:m:uh" opt; do
+  case ${opt} in
+    t) TEST=${OPTARG} ;;
+    b) BASELINE=${OPTARG} ;;
+    r) RESULTS=${OPTARG} ;;
+    k) KEYS=${OPTARG} ;;
+    m) METRICS="${METRICS} ${OPTARG}" ;;
+    u) UPDATE=1 ;;
+    *) sed -n '/^# Usage/,/^$/p' "$0" >&2; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ -z "${TEST}" ] || [ -z "${BASELINE}" ] || [ -z "${RESULTS}" ]; then
+  sed -n '/^# Usage/,/^$/p' "$0" >&2
+  exit 1
+fi
+
+if [ "${UPDATE}" -eq 0 ] && [ ! -f "${BASELINE}" ]; then
+  echo "FAIL ${TEST}: no baseline ${BASELINE}, record one with" \
+       "\"make perf_baseline\" on this host" >&2
+  exit 1
+fi
+
+if [ $# -gt 0 ]; then
+  rc=0
+  "$@" || rc=$?
+  if [ ${rc} -eq 77 ]; then
+    echo "${TEST}: skipped" >&2
+    exit $((UPDATE ? 0 : 77))
+  elif [ ${rc} -ne 0 ]; then
+    echo "${TEST}: command failed with ${rc}" >&2
+    exit 1
+  fi
+fi
+
+if [ ! -s "${RESULTS}" ]; then
+  echo "${TEST}: no results in ${RESULTS}" >&2
+  exit 1
+fi
+
+if [ "${UPDATE}" -eq 1 ] &&
+   { [ ! -f "${BASELINE}" ] || ! grep -q "^${TEST}," "${BASELINE}"; }; then
+  if [ -z "${KEYS}" ] || [ -z "${METRICS}" ]; then
+    echo "${TEST}: no baseline lines in ${BASELINE}, need -k and -m" >&2
+    exit 1
+  fi
+  if [ ! -f "${BASELINE}" ]; then
+    {
+      echo "# Performance baseline for the PERF_TESTS ctest gate, see"
+      echo "# perfcheck.sh. Recorded with \"make perf_baseline\" on"
+      echo "# $(hostname), $(sed -n 's/^model name[[:space:]]*: //p' \
+        /proc/cpuinfo | head -1), $(date -u +%F)."
+      echo "#"
+      echo "# test,key,metric,better,value,tolerance_pct"
+    } > "${BASELINE}"
+  fi
+  awk -F, -v test="${TEST}" -v keys="${KEYS}" -v metrics="${METRICS}" '
+    NR == 1 {
+      for (i = 1; i <= NF; i++) col[$i] = i
+      nk = split(keys, key, ",")
+      nm = split(metrics, metric, " ")
+      next
+    }
+    {
+      k = ""
+      for (i = 1; i <= nk; i++) {
+        k = k (i > 1 ? ";" : "") key[i] "=" $col[key[i]]
+      }
+      for (i = 1; i <= nm; i++) {
+        split(metric[i], m, ":")
+        printf "%s,%s,%s,%s,%s,%s\n", test, k, m[1], m[2], $col[m[1]], m[3]
+      }
+    }' "${RESULTS}" | tee -a "${BASELINE}" | sed 's/^/RECORD /'
+  exit 0
+fi
+
+OUT=$(mktemp)
+trap 'rm -f "${OUT}"' EXIT
+
+awk -F, -v test="${TEST}" -v update="${UPDATE}" -v out="${OUT}" '
+  # First file is the results, the header gives the column names
+  FNR == 1 && NR == 1 {
+    for (i = 1; i <= NF; i++) col[$i] = i
+    next
+  }
+  NR == FNR {
+    rows++
+    for (i = 1; i <= NF; i++) row[rows, i] = $i
+    next
+  }
+
+  # Then the baseline, comments and other tests are kept as they are
+  /^#/ || $1 != test {
+    print > out
+    next
+  }
+  {
+    value = ""
+    n = split($2, keys, ";")
+    for (r = 1; r <= rows && value == ""; r++) {
+      match_all = 1
+      for (k = 1; k <= n; k++) {
+        split(keys[k], kv, "=")
+        if (row[r, col[kv[1]]] != kv[2]) match_all = 0
+      }
+      if (match_all && ($3 in col)) value = row[r, col[$3]]
+    }
+
+    if (value == "") {
+      printf "FAIL %s %s %s: no result\n", test, $2, $3
+      failed++
+      print > out
+      next
+    }
+
+    if (update) {
+      printf "%s,%s,%s,%s,%s,%s\n", $1, $2, $3, $4, value, $6 > out
+      printf "UPDATE %s %s %s: %s (was %s)\n", test, $2, $3, value, $5
+      next
+    }
+    print > out
+
+    if ($4 == "higher") {
+      limit = $5 * (1 - $6 / 100.0)
+      bad = (value + 0 < limit)
+    } else {
+      limit = $5 * (1 + $6 / 100.0)
+      bad = (value + 0 > limit)
+    }
+    printf "%s %s %s %s: %s, baseline %s, limit %.1f\n",
+           bad ? "FAIL" : "PASS", test, $2, $3, value, $5, limit
+    failed += bad
+    checked++
+  }
+  END {
+    if (!update && !checked && !failed) {
+      printf "FAIL %s: no baseline entries\n", test
+      failed++
+    }
+    exit failed ? 1 : 0
+  }' "${RESULTS}" "${BASELINE}" || rc=$?
+
+if [ "${UPDATE}" -eq 1 ]; then
+  cp "${OUT}" "${BASELINE}"
+fi
+exit ${rc:-0}
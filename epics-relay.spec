@@ -17,16 +17,28 @@ Source0:        https://github.com/NSLS-II/epics-relay/archive/%v{version}/epics
 BuildRequires:  cmake
 BuildRequires:  libnet-devel
 BuildRequires:  pcre2-devel
+BuildRequires:  libpcap-devel
 BuildRequires:  libconfig-devel
 BuildRequires:  systemd-devel
 BuildRequires:  systemd-rpm-macros
+BuildRequires:  systemtap-sdt-devel
 Requires:       libnet
 Requires:       pcre2
+Requires:       libpcap
 Requires:       libconfig
 
 %description
 epics-relay UDP Relay and tunnel
 
+%package devel
+Summary:        EPICS relay parsing, filtering and transport library
+Requires:       pcre2-devel
+Requires:       libnet-devel
+
+%description devel
+Static libepicsrelay library and headers for programs relaying EPICS
+traffic
+
 %prep
 %autosetup
 
@@ -41,10 +53,22 @@ VERBOSE=1 make
 %license LICENSE
 %{_bindir}/epics_udp_collector
 %{_bindir}/epics_udp_emitter
+%{_bindir}/epics_udp_hub
+%{_bindir}/epics_relay
+%{_bindir}/epics_relay_ctl
+%{_bindir}/epics_relay_replay
+%{_bindir}/epics_relay_dump
+%{_bindir}/epics_relay_filterc
 %{_unitdir}/epics_udp_emitter@.service
 %{_unitdir}/epics_udp_collector@.service
+%{_unitdir}/epics_udp_hub@.service
+%{_unitdir}/epics_relay@.service
 %{_sysconfdir}/epics-relay_default.conf
 
+%files devel
+%{_libdir}/libepicsrelay.a
+%{_includedir}/epicsrelay/
+
 %changelog
 * Sun Nov 07 2021 Stuart B. Wilkins <swilkins@bnl.gov> - %{version}-0.el8
 - Added deps
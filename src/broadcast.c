@@ -0,0 +1,157 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <libnet.h>
+#include <arpa/inet.h>
+
+#include "debug.h"
+#include "probes.h"
+#include "ethernet.h"
+#include "proto.h"
+#include "broadcast.h"
+
+uint8_t hw_bcast[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+void close_libnet(struct libnet_params *params) {
+  libnet_destroy(params->lnet);
+}
+
+int setup_libnet(struct libnet_params *params, const char *iface) {
+#ifdef LIBNET_MODE_LINK
+  DEBUG_COMMENT("LIBNET_LINK\n");
+  params->lnet = libnet_init(LIBNET_LINK, iface, params->errbuf);
+#else
+  DEBUG_COMMENT("LIBNET_RAW4\n");
+  params->lnet = libnet_init(LIBNET_RAW4, iface, params->errbuf);
+#endif
+  if (params->lnet == NULL) {
+    ERROR_PRINT("Error with libnet_init(): %s", params->errbuf);
+    return -1;
+  }
+
+  if ((params->hw_addr = libnet_get_hwaddr(params->lnet)) == NULL) {
+    ERROR_COMMENT("Unable to read HW address.\n");
+    return -1;
+  }
+
+  DEBUG_PRINT("%s hardware address : %s\n", iface,
+              int_to_mac(params->hw_addr->ether_addr_octet));
+
+  params->udp_t = 0;
+  params->ipv4_t = 0;
+  params->eth_t = 0;
+
+  return 0;
+}
+
+int send_udp_packet(struct libnet_params *params,
+                    unsigned char *packet, ssize_t packet_len) {
+  // Check packet length
+  if (packet_len <= (ssize_t)sizeof(struct proto_udp_header)) {
+    ERROR_PRINT("Invalid packet length %zd\n", packet_len);
+    return -1;
+  }
+
+  struct proto_udp_header *header = (struct proto_udp_header*)packet;
+
+  DEBUG_PRINT("Payload len = %d\n", header->payload_len);
+  struct in_addr ip;
+  ip.s_addr = header->src_ip;
+  DEBUG_PRINT("Source IP : %s\n", inet_ntoa(ip));
+
+  /* build the ethernet header */
+  params->udp_t = libnet_build_udp(
+    htons(header->src_port),                     // src port
+    htons(header->dst_port),                     // dst port
+    LIBNET_UDP_H + header->payload_len,          // Total packet length
+    0,                                           // checksum (autofill)
+    packet + sizeof(struct proto_udp_header),    // payload
+    header->payload_len,                         // length of payload
+    params->lnet, params->udp_t);
+
+  if (params->udp_t == -1) {
+    ERROR_COMMENT("Unable to create UDP packet\n");
+    return -1;
+  }
+
+  params->ipv4_t = libnet_build_ipv4(
+    LIBNET_IPV4_H + LIBNET_UDP_H + header->payload_len,   // Total packet length
+    0,                                            // Type of service
+    libnet_get_prand(LIBNET_PRu16),               // Packet id
+    0x4000,                                       // Frag (don't frag)
+    64,                                           // Time to live
+    IPPROTO_UDP,                                  // Protocol
+    0,                                            // Checksum (autofill)
+    header->src_ip,                               // Source IP
+    params->bcast.s_addr,                         // Dest IP
+    NULL, 0,                                      // Payload
+    params->lnet, params->ipv4_t);
+
+  if (params->ipv4_t == -1) {
+    ERROR_COMMENT("Unable to create IPV4 packet\n");
+    return -1;
+  }
+
+#ifdef LIBNET_MODE_LINK
+  params->eth_t = libnet_build_ethernet(
+    hw_bcast,                                     // Dest hw address
+    (uint8_t*)params->hw_addr,                    // Interface HW Address
+    ETHERTYPE_IP,                                 // Type
+    NULL,                                         // Payload
+    0,                                            // Payload size
+    params->lnet, params->eth_t);
+
+  if (params->eth_t == -1) {
+    ERROR_COMMENT("Unable to create ETH packet\n");
+    return -1;
+  }
+#endif
+
+  // Write the packet and send on the wire
+
+  int sent = libnet_write(params->lnet);
+  PROBE3(broadcast, header->payload_len, sent, params->bcast.s_addr);
+  if (sent == -1) {
+    ERROR_COMMENT("Unable to write packet.");
+    return -1;
+  }
+
+  return 0;
+}
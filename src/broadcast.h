@@ -0,0 +1,59 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef SRC_BROADCAST_H_
+#define SRC_BROADCAST_H_
+
+#include <libnet.h>
+
+struct libnet_params {
+  libnet_t *lnet;
+  struct libnet_ether_addr* hw_addr;
+  libnet_ptag_t udp_t;
+  libnet_ptag_t ipv4_t;
+  libnet_ptag_t eth_t;
+  struct in_addr bcast;
+  char errbuf[LIBNET_ERRBUF_SIZE];
+};
+
+void close_libnet(struct libnet_params *params);
+int setup_libnet(struct libnet_params *params, const char *iface);
+int send_udp_packet(struct libnet_params *params,
+                    unsigned char *packet, ssize_t packet_len);
+
+#endif  // SRC_BROADCAST_H_
@@ -0,0 +1,325 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
+#include "debug.h"
+#include "epics.h"
+#include "bundle.h"
+
+static struct epics_pv_filter* bundle_get_filter(
+    struct epics_filter_set *filters, int n) {
+  return n ? &(filters->dest[n - 1]) : &(filters->global);
+}
+
+int bundle_write(const char *filename, struct epics_filter_set *filters) {
+  int num_filter = 1 + filters->num_dest;
+  int num_rule = epics_filter_count(filters);
+  struct bundle_filter *table = calloc(num_filter,
+                                       sizeof(struct bundle_filter));
+  const pcre2_code **codes = calloc(num_rule ? num_rule : 1,
+                                    sizeof(pcre2_code *));
+  uint8_t *code = NULL;
+  PCRE2_SIZE code_size = 0;
+  size_t exp_size = 0;
+  FILE *fp = NULL;
+
+  if (!table || !codes) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    goto _error;
+  }
+
+  int n = 0;
+  for (int i = 0; i < num_filter; i++) {
+    struct epics_pv_filter *filter = bundle_get_filter(filters, i);
+    table[i].sense = filter->sense;
+    table[i].logic = filter->logic;
+    table[i].first = n;
+    for (struct epics_pv_filter_elem *elem = filter->next; elem;
+         elem = elem->next) {
+      codes[n++] = elem->re;
+      exp_size += strlen(elem->exp) + 1;
+    }
+    table[i].num = n - table[i].first;
+  }
+
+  if (num_rule) {
+    int32_t rc = pcre2_serialize_encode(codes, num_rule, &code, &code_size,
+                                        NULL);
+    if (rc < 0) {
+      PCRE2_UCHAR buffer[256];
+      pcre2_get_error_message(rc, buffer, sizeof(buffer));
+      ERROR_PRINT("Unable to serialize rules: %s\n", buffer);
+      goto _error;
+    }
+  }
+
+  struct bundle_header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = BUNDLE_MAGIC;
+  header.version = BUNDLE_VERSION;
+  header.num_filter = num_filter;
+  header.num_rule = num_rule;
+  header.exp_offset = sizeof(header) + num_filter * sizeof(*table);
+  header.exp_size = exp_size;
+  header.code_offset = (header.exp_offset + exp_size + 7) & ~(uint64_t)7;
+  header.code_size = code_size;
+
+  if (!(fp = fopen(filename, "w"))) {
+    ERROR_PRINT("Unable to open %s : %s\n", filename, strerror(errno));
+    goto _error;
+  }
+
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(table, sizeof(*table), num_filter, fp);
+  for (int i = 0; i < num_filter; i++) {
+    for (struct epics_pv_filter_elem *elem =
+         bundle_get_filter(filters, i)->next; elem; elem = elem->next) {
+      fwrite(elem->exp, strlen(elem->exp) + 1, 1, fp);
+    }
+  }
+  for (uint64_t pad = header.exp_offset + exp_size;
+       pad < header.code_offset; pad++) {
+    fputc(0, fp);
+  }
+  if (code_size) {
+    fwrite(code, code_size, 1, fp);
+  }
+
+  if (ferror(fp) | fclose(fp)) {
+    fp = NULL;
+    ERROR_PRINT("Unable to write %s\n", filename);
+    goto _error;
+  }
+
+  if (code) {
+    pcre2_serialize_free(code);
+  }
+  free(codes);
+  free(table);
+  return 0;
+
+_error:
+  if (fp) {
+    fclose(fp);
+  }
+  if (code) {
+    pcre2_serialize_free(code);
+  }
+  free(codes);
+  free(table);
+  return -1;
+}
+
+static int bundle_check(const struct bundle_header *header, size_t size,
+                        int num_dest) {
+  if ((size < sizeof(struct bundle_header)) ||
+      (header->magic != BUNDLE_MAGIC)) {
+    ERROR_COMMENT("Not a filter bundle\n");
+    return -1;
+  }
+
+  if (header->version != BUNDLE_VERSION) {
+    ERROR_PRINT("Filter bundle version %u, expected %u\n",
+                header->version, BUNDLE_VERSION);
+    return -1;
+  }
+
+  if (!header->num_filter ||
+      (header->exp_offset != sizeof(struct bundle_header) +
+       (uint64_t)header->num_filter * sizeof(struct bundle_filter)) ||
+      (header->exp_offset + header->exp_size > size) ||
+      (header->code_offset + header->code_size > size) ||
+      (!header->code_size != !header->num_rule)) {
+    ERROR_COMMENT("Filter bundle is truncated or corrupt\n");
+    return -1;
+  }
+
+  // Without per destination rules the bundle only has the global filter
+  if ((num_dest >= 0) && (header->num_filter != 1) &&
+      (header->num_filter != (uint32_t)num_dest + 1)) {
+    ERROR_PRINT("Filter bundle is for %u emitters, not %d\n",
+                header->num_filter - 1, num_dest);
+    return -1;
+  }
+
+  if (header->num_filter - 1 > EPICS_MAX_DEST) {
+    ERROR_COMMENT("Filter bundle has too many emitters\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+struct epics_filter_set* bundle_read(const char *filename, int num_dest) {
+  struct epics_filter_set *filters = NULL;
+  pcre2_code **codes = NULL;
+  int num_codes = 0;
+
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if ((fd < 0) || fstat(fd, &st)) {
+    ERROR_PRINT("Unable to open %s : %s\n", filename, strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+
+  size_t size = st.st_size;
+  const char *map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) :
+                    MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) {
+    ERROR_PRINT("Unable to map %s\n", filename);
+    return NULL;
+  }
+
+  const struct bundle_header *header = (const struct bundle_header *)map;
+  if (bundle_check(header, size, num_dest)) {
+    goto _error;
+  }
+
+  const struct bundle_filter *table = (const struct bundle_filter *)
+    (map + sizeof(struct bundle_header));
+  const char *exp = map + header->exp_offset;
+  const char *exp_end = exp + header->exp_size;
+
+  filters = calloc(1, sizeof(struct epics_filter_set));
+  if (!filters) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    goto _error;
+  }
+  if (header->num_filter > 1) {
+    filters->num_dest = header->num_filter - 1;
+    filters->dest = calloc(filters->num_dest, sizeof(struct epics_pv_filter));
+    if (!filters->dest) {
+      ERROR_COMMENT("Unable to allocate memory\n");
+      goto _error;
+    }
+  }
+
+  // Decoding copies the compiled code, nothing is compiled again
+  if (header->num_rule) {
+    const uint8_t *code = (const uint8_t *)map + header->code_offset;
+    codes = calloc(header->num_rule, sizeof(pcre2_code *));
+    if (!codes) {
+      ERROR_COMMENT("Unable to allocate memory\n");
+      goto _error;
+    }
+    if (pcre2_serialize_get_number_of_codes(code) !=
+        (int32_t)header->num_rule) {
+      ERROR_COMMENT("Filter bundle rule count does not match\n");
+      goto _error;
+    }
+    int32_t rc = pcre2_serialize_decode(codes, header->num_rule, code, NULL);
+    if (rc < 0) {
+      PCRE2_UCHAR buffer[256];
+      pcre2_get_error_message(rc, buffer, sizeof(buffer));
+      ERROR_PRINT("Unable to load filter bundle %s: %s, rebuild it with "
+                  "this version of PCRE2\n", filename, buffer);
+      goto _error;
+    }
+    num_codes = rc;
+  }
+
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < header->num_filter; i++) {
+    struct epics_pv_filter *filter = bundle_get_filter(filters, i);
+    filter->sense = table[i].sense;
+    filter->logic = table[i].logic;
+
+    if ((table[i].first != n) ||
+        (table[i].num > header->num_rule - n)) {
+      ERROR_COMMENT("Filter bundle rule table is corrupt\n");
+      goto _error;
+    }
+
+    struct epics_pv_filter_elem **current = &(filter->next);
+    for (uint32_t j = 0; j < table[i].num; j++, n++) {
+      size_t len = strnlen(exp, exp_end - exp);
+      if (exp + len >= exp_end) {
+        ERROR_COMMENT("Filter bundle expressions are corrupt\n");
+        goto _error;
+      }
+
+      struct epics_pv_filter_elem *elem =
+        malloc(sizeof(struct epics_pv_filter_elem));
+      if (!elem || !(elem->exp = strdup(exp))) {
+        ERROR_COMMENT("Unable to allocate memory\n");
+        free(elem);
+        goto _error;
+      }
+      elem->re = codes[n];
+      codes[n] = NULL;
+      elem->next = NULL;
+      *current = elem;
+      current = &(elem->next);
+      exp += len + 1;
+    }
+  }
+
+  if (n != header->num_rule) {
+    ERROR_COMMENT("Filter bundle rule table is corrupt\n");
+    goto _error;
+  }
+
+  free(codes);
+  munmap((void *)map, size);
+  return filters;
+
+_error:
+  for (int i = 0; i < num_codes; i++) {
+    if (codes[i]) {
+      pcre2_code_free(codes[i]);
+    }
+  }
+  free(codes);
+  epics_filter_set_free(filters);
+  munmap((void *)map, size);
+  return NULL;
+}
@@ -0,0 +1,77 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef SRC_BUNDLE_H_
+#define SRC_BUNDLE_H_
+
+#include <stdint.h>
+
+#include "epics.h"
+
+#define BUNDLE_MAGIC        0x42465045  // "EPFB"
+#define BUNDLE_VERSION      1
+
+// Precompiled filter set. The header is followed by one bundle_filter
+// for the global filter and each destination, the expressions as NUL
+// terminated strings in rule order, and all compiled rules serialized
+// by pcre2_serialize_encode(). The serialized code is only valid for
+// the PCRE2 build and architecture that wrote it, a mismatch is found
+// on loading.
+
+struct bundle_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_filter;          // Global, then one per destination
+  uint32_t num_rule;
+  uint64_t exp_offset;
+  uint64_t exp_size;
+  uint64_t code_offset;
+  uint64_t code_size;
+};
+
+struct bundle_filter {
+  int32_t sense;
+  int32_t logic;
+  uint32_t first;               // Index of the first rule
+  uint32_t num;
+};
+
+int bundle_write(const char *filename, struct epics_filter_set *filters);
+// num_dest < 0 accepts a bundle for any number of destinations
+struct epics_filter_set* bundle_read(const char *filename, int num_dest);
+
+#endif  // SRC_BUNDLE_H_
@@ -40,6 +40,9 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/select.h>
@@ -55,13 +58,19 @@
 
 #include "ethernet.h"
 #include "debug.h"
+#include "probes.h"
 #include "proto.h"
 #include "epics.h"
 #include "collector.h"
 #include "defs.h"
 #include "config.h"
+#include "control.h"
+#include "resolver.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "daemon.h"
 
-int debug_flag = 0;
+#ifndef EPICS_RELAY_COMBINED
 extern const char* EPICS_RELAY_GIT_REV;
 extern const char* EPICS_RELAY_GIT_BRANCH;
 extern const char* EPICS_RELAY_GIT_VERSION;
@@ -71,23 +80,13 @@ static struct option long_options[] = {
   {"config", required_argument, 0, 'c'},
   {0, 0, 0, 0}
 };
-
-void print_bind_info(int fd) {
-  char ip[16];
-  unsigned int port;
-  struct sockaddr_in addr;
-
-  bzero(&addr, sizeof(addr));
-  socklen_t len = sizeof(addr);
-  getsockname(fd, (struct sockaddr *) &addr, &len);
-  inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
-  port = ntohs(addr.sin_port);
-
-  DEBUG_PRINT("Bound to %s:%d\n", ip, port);
-}
+#endif  // EPICS_RELAY_COMBINED
 
 int setup_sockets(collector_params *params) {
-  for (int i = 0; i < params->num_fd; i++) {
+  // The shared memory ring has no socket
+  int num_fd = params->num_fd - params->shm;
+
+  for (int i = 0; i < num_fd; i++) {
     if (bind_socket(params->iface.address,
                     0, 0,
                     &(params->fd[i]))) {
@@ -97,6 +96,14 @@ int setup_sockets(collector_params *params) {
     print_bind_info(params->fd[i]);
   }
 
+  if (params->mcast) {
+    // Multicast group is always the last emitter
+    if (multicast_sender(params->fd[num_fd - 1],
+                         params->mcast_iface, params->mcast_ttl)) {
+      return -1;
+    }
+  }
+
   for (int i = 0; i < params->fd_listen_max; i++) {
     DEBUG_PRINT("Setting up port %d\n", params->listen_ports[i]);
     if (bind_socket(params->iface_listen.broadcast,
@@ -105,125 +112,489 @@ int setup_sockets(collector_params *params) {
       return -1;
     }
     print_bind_info(params->fd_listen[i]);
+
+    char name[160];
+    snprintf(name, sizeof(name), "%s:%d", params->iface_listen_name,
+             params->listen_ports[i]);
+    params->sock_listen[i] = stats_socket(name, &(params->stats));
+    stats_socket_open(params->sock_listen[i], params->fd_listen[i]);
+  }
+
+  if (params->shm) {
+    params->fd[params->num_fd - 1] = -1;
+    if (!(params->ring = ring_shm_open(params->shm_name, params->shm_slots,
+                                       PROTO_BUF_SIZE))) {
+      return -1;
+    }
+    NOTICE_PRINT("Relaying to shared memory %s\n", params->shm_name);
   }
   return 0;
 }
 
-void listen_start(collector_params *params) {
-  fd_set socks;
+int collector_fdset(collector_params *params, fd_set *socks) {
+  for (int i = 0; i < params->fd_listen_max; i++) {
+    FD_SET(params->fd_listen[i], socks);
+  }
 
-  FD_ZERO(&socks);
+  return intmax(params->fd_listen, params->fd_listen_max);
+}
 
-  // Allocate data buffer
-  char data_src[2048];
-  char data_dst[2048];
+static void collector_record(collector_params *params, int n,
+                             struct sockaddr_in *si, struct timespec *ts,
+                             int len, int verdict, uint64_t mask) {
+  struct recorder_record *record = recorder_reserve(params->recorder);
+  int caplen = (len < params->recorder_snaplen) ?
+               len : params->recorder_snaplen;
+
+  // Kernel timestamps are missing when not supported by the socket
+  struct timespec now = *ts;
+  if (!now.tv_sec) {
+    clock_gettime(CLOCK_REALTIME, &now);
+  }
 
-  // Set header struct
+  record->ts = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  record->src_ip = si->sin_addr.s_addr;
+  record->dst_ip = params->iface_listen.broadcast.s_addr;
+  record->src_port = ntohs(si->sin_port);
+  record->dst_port = params->listen_ports[n];
+  record->len = len;
+  record->caplen = caplen;
+  record->verdict = verdict;
+  record->num_frames = 0;
+  record->search = 0;
+  if (verdict >= RECORDER_FILTERED) {
+    record->num_frames = params->packet->num_frames;
+    record->search = params->packet->search;
+  }
+  record->mask = mask;
+  memcpy(record->data, params->data_src, caplen);
+
+  recorder_commit(params->recorder, record);
+}
+
+void collector_receive(collector_params *params, int n) {
+  struct sockaddr_in si;
+  struct timespec ts;
+  uint32_t drops;
+  char *data_src = params->data_src;
+  char *data_dst = params->data_dst;
   struct proto_udp_header *header = (struct proto_udp_header*)data_dst;
-  memset(header, 0, sizeof(struct proto_udp_header));
 
-  header->magic = PROTO_MAGIC_NUMBER;
-  header->version = PROTO_VERSION;
-  header->type = PROTO_TYPE;
+  int len = recv_timestamp(params->fd_listen[n], data_src, PROTO_BUF_SIZE,
+                           &si, &ts, &drops);
+
+  DEBUG_PRINT("Recieve %d: %s:%d %d bytes\n", n,
+              inet_ntoa(si.sin_addr), ntohs(si.sin_port), len);
+
+  if (len <= 0) {
+    return;
+  }
+  stats_inc(STATS_RX_CA_SERVER + n);
+  PROBE3(receive, params->listen_ports[n], len, si.sin_addr.s_addr);
+  stats_drops(params->sock_listen[n], params->fd_listen[n], drops, &ts);
+
+  if (!is_native_packet(&(si.sin_addr), &(params->iface_listen))) {
+    DEBUG_COMMENT("Non native packet ... skipping ...\n");
+    if (params->recorder) {
+      collector_record(params, n, &si, &ts, len, RECORDER_FOREIGN, 0);
+    }
+    return;
+  }
+
+  // Fill in the header with packet data
+  header->src_ip = si.sin_addr.s_addr;
+  header->src_port = si.sin_port;
+  header->dst_port = htons(params->listen_ports[n]);
+  header->dst_ip = params->iface_listen.broadcast.s_addr;
+
+  // Now read EPICS data, filters are evaluated once per PV
 
-  // Find max fd
-  int maxfd = intmax(params->fd_listen, params->fd_listen_max);
+  rcu_read_lock(&(params->rcu[0]));
+  struct epics_filter_set *filter = __atomic_load_n(&(params->filter),
+                                                    __ATOMIC_ACQUIRE);
+
+  int num_frames = epics_parse_packet(params->packet, data_src, len, filter);
+
+  // Without per emitter filters all emitters get the same packet
+  int shared = !filter->num_dest;
+  rcu_read_unlock(&(params->rcu[0]));
+
+  if (!num_frames) {
+    // We have no valid packet
+    DEBUG_COMMENT("No valid packet....\n");
+    if (params->recorder) {
+      collector_record(params, n, &si, &ts, len, RECORDER_INVALID, 0);
+    }
+    return;
+  }
+  stats_latency(STATS_LATENCY_PARSE, &ts);
+
+  char *data_out = NULL;
+  int _len = 0;
+  int built = 0;
+  uint64_t relayed = 0;
+
+  for (int i = 0; i < params->num_fd; i++) {
+    int local = params->shm && (i == (params->num_fd - 1));
+
+    if (!shared || (i == 0)) {
+      uint64_t mask = shared ? 1 : ((uint64_t)1 << i);
+      struct compress_dict *dict = NULL;
+      if (params->dict && !local) {
+        dict = params->dict[shared ? 0 : i];
+      }
+      _len = proto_build_packet(params->packet, data_src, mask, dict,
+                                data_dst, params->data_cmp, &data_out);
+      DEBUG_PRINT("_len = %d\n", _len);
+    }
+
+    if (!_len) {
+      continue;
+    }
+    built = 1;
+
+    if (local) {
+      // Compression only ever writes to data_cmp, so the local emitter
+      // takes the uncompressed packet from data_dst
+      int raw_len = ((struct proto_udp_header*)data_dst)->payload_len +
+        sizeof(struct proto_udp_header);
+      void *slot = ring_reserve(params->ring);
+      stats_send(i, slot != NULL);
+      PROBE3(send, i, slot ? raw_len : -1, 0);
+      if (!slot) {
+        DEBUG_COMMENT("Shared memory ring full ... dropping ...\n");
+        continue;
+      }
+      memcpy(slot, data_dst, raw_len);
+      ring_commit(params->ring, raw_len);
+      relayed |= (uint64_t)1 << (i & 63);
+      continue;
+    }
+
+    // The resolver may change the address at any time
+    struct sockaddr_in addr = params->emitter_addr[i];
+    addr.sin_addr.s_addr = __atomic_load_n(
+      &(params->emitter_addr[i].sin_addr.s_addr), __ATOMIC_RELAXED);
+    if (addr.sin_addr.s_addr == INADDR_ANY) {
+      DEBUG_PRINT("Emitter %d not resolved ... skipping ...\n", i);
+      continue;
+    }
+
+    // Now transmit header
+    int sent = sendto(params->fd[i],
+                      data_out,
+                      _len + sizeof(struct proto_udp_header), 0,
+                      (struct sockaddr *)&addr,
+                      sizeof(struct sockaddr_in));
+    stats_send(i, sent >= 0);
+    PROBE3(send, i, sent, addr.sin_addr.s_addr);
+
+    if (sent < 0) {
+      ERROR_COMMENT("Unable to send....\n");
+      continue;
+    }
+    relayed |= (uint64_t)1 << (i & 63);
+
+#ifdef DEBUG
+    char name[INET_ADDRSTRLEN];
+    if (inet_ntop(AF_INET, &(addr.sin_addr), name, sizeof(name))) {
+      DEBUG_PRINT("Sent %d bytes to %s:%d\n", sent,
+                  name, ntohs(addr.sin_port));
+    }
+#endif
+  }
+
+  if (relayed) {
+    stats_latency(STATS_LATENCY_SEND, &ts);
+  }
+
+  if (params->recorder) {
+    int verdict = relayed ? RECORDER_RELAYED :
+                  (built ? RECORDER_FAILED : RECORDER_FILTERED);
+    collector_record(params, n, &si, &ts, len, verdict, relayed);
+  }
+}
+
+void collector_iface_update_relay(collector_params *params) {
+  struct in_addr address = params->iface.address;
+
+  // Relay sockets send from the interface address
+  if ((iface_refresh(params->iface_name, &(params->iface)) > 0) &&
+      (address.s_addr != params->iface.address.s_addr)) {
+    int num_fd = params->num_fd - params->shm;
+    for (int i = 0; i < num_fd; i++) {
+      if (rebind_socket(params->iface.address, 0, 0, &(params->fd[i]))) {
+        ERROR_COMMENT("Unable to rebind relay socket\n");
+      }
+    }
+
+    if (params->mcast) {
+      if (params->mcast_iface.s_addr == address.s_addr) {
+        params->mcast_iface = params->iface.address;
+      }
+      multicast_sender(params->fd[num_fd - 1], params->mcast_iface,
+                       params->mcast_ttl);
+    }
+  }
+}
+
+void collector_iface_update_listen(collector_params *params) {
+  struct in_addr broadcast = params->iface_listen.broadcast;
+
+  // Listen sockets are bound to the broadcast address
+  if ((iface_refresh(params->iface_listen_name,
+                     &(params->iface_listen)) > 0) &&
+      (broadcast.s_addr != params->iface_listen.broadcast.s_addr)) {
+    for (int i = 0; i < params->fd_listen_max; i++) {
+      if (rebind_socket(params->iface_listen.broadcast,
+                        params->listen_ports[i], 1,
+                        &(params->fd_listen[i]))) {
+        ERROR_COMMENT("Unable to rebind listen socket\n");
+        continue;
+      }
+      stats_socket_open(params->sock_listen[i], params->fd_listen[i]);
+    }
+  }
+}
+
+void collector_iface_update(collector_params *params) {
+  collector_iface_update_relay(params);
+  collector_iface_update_listen(params);
+}
+
+void listen_start(collector_params *params) {
+  fd_set socks;
 
   // Loop forever!
   while (1) {
-    for (int i = 0; i < params->fd_listen_max; i++) {
-      FD_SET(params->fd_listen[i], &socks);
+    FD_ZERO(&socks);
+    int maxfd = collector_fdset(params, &socks);
+    if (params->fd_netlink >= 0) {
+      FD_SET(params->fd_netlink, &socks);
+      maxfd = (params->fd_netlink > maxfd) ? params->fd_netlink : maxfd;
     }
 
     // Setup select for multiple descriptors
-    select(maxfd, &socks, NULL, NULL, NULL);
+    if (select(maxfd + 1, &socks, NULL, NULL, NULL) < 0) {
+      ERROR_COMMENT("Select failed\n");
+      continue;
+    }
 
-    struct sockaddr_in si;
-    unsigned slen = sizeof(struct sockaddr);
+    // Interface changes are applied between packets
+    if ((params->fd_netlink >= 0) && FD_ISSET(params->fd_netlink, &socks) &&
+        (iface_monitor_read(params->fd_netlink) > 0)) {
+      collector_iface_update(params);
+      continue;
+    }
 
     // Cycle through fd
     for (int i = 0; i < params->fd_listen_max; i++) {
       if (FD_ISSET(params->fd_listen[i], &socks)) {
-        int len = recvfrom(params->fd_listen[i],
-                           data_src, sizeof(data_src),
-                           0, (struct sockaddr *)&si, &slen);
-
-        DEBUG_PRINT("Recieve %d: %s:%d %d bytes\n", i,
-                    inet_ntoa(si.sin_addr), ntohs(si.sin_port), len);
-
-        if (len != 0) {
-          if (!is_native_packet(&(si.sin_addr), &(params->iface_listen))) {
-            DEBUG_COMMENT("Non native packet ... skipping ...\n");
-            continue;
-          }
-
-          // Fill in the header with packet data
-          header->src_ip = si.sin_addr.s_addr;
-          header->src_port = si.sin_port;
-          header->dst_port = htons(params->listen_ports[i]);
-          header->dst_ip = params->iface_listen.broadcast.s_addr;
-
-          // Now read EPICS data
-
-          int _len = epics_read_packet(data_dst +
-                                       sizeof(struct proto_udp_header),
-                                       data_src, len, &(params->filter));
-          DEBUG_PRINT("_len = %d\n", _len);
-          if (!_len) {
-            // We have no valid packet
-            DEBUG_COMMENT("No valid packet....\n");
-            continue;
-          }
-
-          header->payload_len = _len;
-
-          for (int i = 0; i < params->num_fd; i++) {
-            // Now transmit header
-            int n = sendto(params->fd[i],
-                          data_dst,
-                          _len + sizeof(struct proto_udp_header), 0,
-                          (struct sockaddr *)&(params->emitter_addr[i]),
-                          sizeof(struct sockaddr_in));
-
-            if (n < 0) {
-              ERROR_COMMENT("Unable to send....\n");
-              continue;
-            }
-
-#ifdef DEBUG
-            char name[INET_ADDRSTRLEN];
-            if (inet_ntop(AF_INET, &(params->emitter_addr[i].sin_addr),
-                          name, sizeof(name))) {
-              DEBUG_PRINT("Sent %d bytes to %s:%d\n", n,
-                          name, ntohs(params->emitter_addr[i].sin_port));
-            }
-#endif
-          }
-
-          break;
-        }
+        collector_receive(params, i);
+        break;
       }
     }
   }
 }
 
-int start_collector(collector_params *params) {
+int collector_setup(collector_params *params) {
   // Setup ports to listen to
-  params->listen_ports[0] = 5064;
-  params->listen_ports[1] = 5065;
-  params->listen_ports[2] = 5076;
+  params->listen_ports[0] = EPICS_CA_SERVER_PORT;
+  params->listen_ports[1] = EPICS_CA_REPEATER_PORT;
+  params->listen_ports[2] = EPICS_PVA_BROADCAST_PORT;
   params->fd_listen_max = 3;
 
-  setup_sockets(params);
-  listen_start(params);
+  params->dict = NULL;
+  params->num_dict = 0;
+  if (params->compress) {
+    NOTICE_PRINT("Compressing relay link (keyframe every %d s)\n",
+                 params->keyframe);
+
+    // Each emitter needs its own dictionary if it gets its own packets
+    params->num_dict = params->filter->num_dest ? params->num_fd : 1;
+    params->dict = calloc(params->num_dict, sizeof(struct compress_dict*));
+    if (!params->dict) {
+      ERROR_COMMENT("Unable to allocate memory\n");
+      return -1;
+    }
+    for (int i = 0; i < params->num_dict; i++) {
+      if (!(params->dict[i] = compress_dict_create(params->keyframe))) {
+        return -1;
+      }
+    }
+  }
+
+  pthread_mutex_init(&(params->filter_lock), NULL);
+
+  // The receive loop, or each pipeline filter worker, reads the filters
+  params->num_rcu = params->pipeline_workers ? params->pipeline_workers : 1;
+  params->rcu = aligned_alloc(RCU_CACHE_LINE,
+                              params->num_rcu * sizeof(struct rcu_reader));
+  if (!params->rcu) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return -1;
+  }
+  memset(params->rcu, 0, params->num_rcu * sizeof(struct rcu_reader));
+
+  // Buffers may be provided by the caller to share them with other roles,
+  // the destination buffer holds the header so is always our own
+  if (!params->data_src) {
+    params->data_src = malloc(PROTO_BUF_SIZE);
+  }
+  if (!params->data_cmp) {
+    params->data_cmp = malloc(PROTO_BUF_SIZE);
+  }
+  params->data_dst = malloc(PROTO_BUF_SIZE);
+  params->packet = malloc(sizeof(struct epics_packet));
+  if (!params->data_src || !params->data_cmp ||
+      !params->data_dst || !params->packet) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return -1;
+  }
+
+  // Set header struct
+  proto_header_init((struct proto_udp_header*)params->data_dst);
+
+  if (setup_sockets(params)) {
+    return -1;
+  }
+
+  params->recorder = NULL;
+  if (params->recorder_file[0]) {
+    if (!(params->recorder = recorder_open(params->recorder_file,
+                                           params->recorder_records,
+                                           params->recorder_snaplen))) {
+      return -1;
+    }
+  }
+
+  params->pipeline = NULL;
+  if (params->pipeline_workers && pipeline_setup(params)) {
+    return -1;
+  }
+
+  // Follow address changes, relaying works without it
+  if (iface_monitor_open(&(params->fd_netlink))) {
+    ERROR_COMMENT("Interface changes will not be tracked\n");
+  }
+
+  return 0;
+}
+
+int collector_reload(collector_params *params, const char *filename) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct epics_filter_set *filter = config_read_filter_set(filename, params);
+  if (!filter) {
+    ERROR_COMMENT("Reload failed, keeping current filters\n");
+    return -1;
+  }
+
+  pthread_mutex_lock(&(params->filter_lock));
+
+  // Dictionaries are allocated for shared or per emitter packets
+  struct epics_filter_set *old = params->filter;
+  if (params->dict && (!filter->num_dest != !old->num_dest)) {
+    pthread_mutex_unlock(&(params->filter_lock));
+    ERROR_COMMENT("Per emitter regex can not be added or removed "
+                  "by a reload with compression, restart instead\n");
+    epics_filter_set_free(filter);
+    return -1;
+  }
+
+  // Publish, then free the old filters once no packet uses them
+  __atomic_store_n(&(params->filter), filter, __ATOMIC_RELEASE);
+  rcu_synchronize(params->rcu, params->num_rcu);
+  epics_filter_set_free(old);
+
+  pthread_mutex_unlock(&(params->filter_lock));
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  NOTICE_PRINT("Reloaded %d regex rules from %s in %.3f ms\n",
+               epics_filter_count(filter), filename,
+               (end.tv_sec - start.tv_sec) * 1e3 +
+               (end.tv_nsec - start.tv_nsec) / 1e6);
+
+  return 0;
+}
+
+struct collector_reload_args {
+  collector_params *params;
+  const char *filename;
+};
+
+static void* collector_reload_thread(void *arg) {
+  struct collector_reload_args *args = arg;
+  sigset_t sigs;
+  int sig;
+
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGHUP);
+
+  for (;;) {
+    if (sigwait(&sigs, &sig) || (sig != SIGHUP)) {
+      continue;
+    }
+    NOTICE_COMMENT("SIGHUP received, reloading filters\n");
+    collector_reload(args->params, args->filename);
+  }
+
+  return NULL;
+}
+
+int collector_reload_start(collector_params *params, const char *filename) {
+  static struct collector_reload_args args;
+  sigset_t sigs;
+  pthread_t thread;
+
+  args.params = params;
+  args.filename = filename;
+
+  // Block SIGHUP here so only the reload thread takes it
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGHUP);
+  if (pthread_sigmask(SIG_BLOCK, &sigs, NULL)) {
+    ERROR_COMMENT("Unable to block SIGHUP\n");
+    return -1;
+  }
+
+  if (pthread_create(&thread, NULL, collector_reload_thread, &args)) {
+    ERROR_COMMENT("Unable to start reload thread\n");
+    return -1;
+  }
+  pthread_detach(thread);
 
   return 0;
 }
 
+#ifndef EPICS_RELAY_COMBINED
+static void* collector_thread(void *arg) {
+  collector_params *params = arg;
+
+  if (params->pipeline) {
+    pipeline_start(params);
+  } else {
+    listen_start(params);
+  }
+
+  return NULL;
+}
+
 int main(int argc, char *argv[]) {
   collector_params params;
   char *config_file = DEFAULT_CONFIG_FILE;
 
+  if (log_start()) {
+    ERROR_COMMENT("Unable to start logging thread\n");
+    exit(-1);
+  }
+  if (daemon_signals()) {
+    exit(-1);
+  }
+
+  // Clients of the control socket may hang up before their reply
+  signal(SIGPIPE, SIG_IGN);
   NOTICE_PRINT("Verstion : %s (%s)\n",
                EPICS_RELAY_GIT_VERSION, EPICS_RELAY_GIT_REV);
 
@@ -252,14 +623,36 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  memset(&params, 0, sizeof(params));
   if (config_read_collector(config_file, &params)) {
     ERROR_COMMENT("Unable to process config file\n");
     exit(-1);
   }
 
-  start_collector(&params);
+  if (collector_setup(&params)) {
+    exit(-1);
+  }
+
+  if (collector_reload_start(&params, config_file)) {
+    exit(-1);
+  }
+
+  if (control_start(&params)) {
+    exit(-1);
+  }
+
+  if (resolver_start(&params)) {
+    exit(-1);
+  }
+
+  if (stats_start(&(params.stats))) {
+    exit(-1);
+  }
+
+  daemon_run(collector_thread, &params);
 
   // TODO(swilkins) close sockets
   // TODO(swilkins) free fd and emitter
   // TODO(swilkins) destroy linked list
 }
+#endif  // EPICS_RELAY_COMBINED
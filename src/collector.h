@@ -38,23 +38,77 @@
 #ifndef SRC_COLLECTOR_H_
 #define SRC_COLLECTOR_H_
 
+#include <sys/select.h>
+#include <pthread.h>
+
 #include "ethernet.h"
 #include "epics.h"
+#include "compress.h"
+#include "ring.h"
+#include "rcu.h"
+#include "recorder.h"
+#include "stats.h"
 
 #define MAX_FD        50
 
+struct pipeline;
+
 typedef struct {
   int *fd;
   int num_fd;
-  struct sockaddr_in *emitter_addr;
+  struct sockaddr_in *emitter_addr;   // Address updated by the resolver
+  char **hostname;                    // NULL if given as an address
+  int resolve_interval;
   int fd_listen[MAX_FD];
+  struct stats_socket *sock_listen[MAX_FD];
   int listen_ports[MAX_FD];
   int fd_listen_max;
+  char iface_name[128];
   struct ifdatav4 iface;
+  char iface_listen_name[128];
   struct ifdatav4 iface_listen;
+  int fd_netlink;
   int *port;
-  struct epics_pv_filter filter;
+  struct epics_filter_set *filter;  // Swapped on reload, see rcu.h
+  struct rcu_reader *rcu;           // One per thread reading filter
+  int num_rcu;
+  pthread_mutex_t filter_lock;      // Serializes filter updates
+  char control[108];
+  int fd_control;
+  struct stats_config stats;
+  int mcast;
+  int mcast_ttl;
+  struct in_addr mcast_iface;
+  int compress;
+  int keyframe;
+  struct compress_dict **dict;
+  int num_dict;
+  char *data_src;
+  char *data_dst;
+  char *data_cmp;
+  struct epics_packet *packet;
+  int shm;
+  char shm_name[128];
+  int shm_slots;
+  struct ring *ring;
+  char recorder_file[256];          // Empty for no recorder
+  uint64_t recorder_records;
+  int recorder_snaplen;
+  struct recorder *recorder;
+  int pipeline_workers;             // 0 to filter in the receive loop
+  int pipeline_slots;
+  int pipeline_batch;
+  struct pipeline *pipeline;
 } collector_params;
 
+int collector_setup(collector_params *params);
+int collector_fdset(collector_params *params, fd_set *socks);
+void collector_receive(collector_params *params, int n);
+void collector_iface_update(collector_params *params);
+void collector_iface_update_relay(collector_params *params);
+void collector_iface_update_listen(collector_params *params);
+int collector_reload(collector_params *params, const char *filename);
+int collector_reload_start(collector_params *params, const char *filename);
+
 
 #endif  // SRC_COLLECTOR_H_
@@ -0,0 +1,353 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "debug.h"
+#include "epics.h"
+#include "compress.h"
+#include "pva.h"
+
+static uint32_t compress_hash(const char *data, int len) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t compress_check(uint32_t hash, int len) {
+  // The slot holds the low 12 bits, the check has the other 20 and the
+  // name length so a stale entry is only taken for an identical name
+  return (hash >> 12) | ((uint32_t)(len & 0xff) << 20);
+}
+
+static void compress_next_epoch(struct compress_dict *dict) {
+  // Epoch 0 is reserved to mark an empty entry
+  if (++dict->epoch == 0) {
+    dict->epoch = 1;
+  }
+}
+
+struct compress_dict* compress_dict_create(int keyframe) {
+  struct compress_dict *dict = calloc(1, sizeof(struct compress_dict));
+  if (dict == NULL) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return NULL;
+  }
+
+  if (keyframe <= 0) {
+    keyframe = COMPRESS_KEYFRAME;
+  }
+  dict->keyframe = keyframe;
+
+  // Start from an arbitrary epoch so a restarted collector never
+  // reuses the dictionary an emitter still holds
+  dict->epoch = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+  compress_next_epoch(dict);
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &dict->start);
+
+  return dict;
+}
+
+void compress_dict_free(struct compress_dict *dict) {
+  free(dict);
+}
+
+static int compress_put_raw(char *dest, int dest_size,
+                            const char *src, int len) {
+  if ((int)sizeof(struct compress_rec_raw) + len > dest_size) {
+    return -1;
+  }
+
+  struct compress_rec_raw *rec = (struct compress_rec_raw *)dest;
+  rec->tag = COMPRESS_REC_RAW;
+  rec->len = htons(len);
+  memcpy(dest + sizeof(struct compress_rec_raw), src, len);
+  return sizeof(struct compress_rec_raw) + len;
+}
+
+static int compress_put_search(struct compress_dict *dict,
+                               char *dest, int dest_size,
+                               const char *src, int len) {
+  const struct ca_proto_search *req = (const struct ca_proto_search *)src;
+  const char *name = src + sizeof(struct ca_proto_search);
+  int name_len = len - sizeof(struct ca_proto_search);
+
+  uint32_t hash = compress_hash(name, name_len);
+  uint32_t check = compress_check(hash, name_len);
+  struct compress_dict_entry *entry =
+    &dict->entry[hash & (COMPRESS_DICT_SIZE - 1)];
+
+  int define = (entry->epoch != dict->epoch) ||
+               (entry->check != check) ||
+               (entry->len != name_len) ||
+               memcmp(entry->name, name, name_len);
+
+  int size = sizeof(struct compress_rec_search);
+  if (define) {
+    size += 1 + name_len;
+  }
+  if (size > dest_size) {
+    return -1;
+  }
+
+  struct compress_rec_search *rec = (struct compress_rec_search *)dest;
+  rec->slot = htons(hash & (COMPRESS_DICT_SIZE - 1));
+  rec->check = htonl(check);
+  rec->reply = req->reply;
+  rec->version = req->version;
+  rec->cid1 = req->cid1;
+  rec->cid2 = req->cid2;
+
+  if (define) {
+    DEBUG_PRINT("Define slot %d\n", ntohs(rec->slot));
+    rec->tag = COMPRESS_REC_DEFINE;
+    dest[sizeof(struct compress_rec_search)] = (uint8_t)name_len;
+    memcpy(dest + sizeof(struct compress_rec_search) + 1, name, name_len);
+
+    entry->epoch = dict->epoch;
+    entry->check = check;
+    entry->len = name_len;
+    memcpy(entry->name, name, name_len);
+  } else {
+    DEBUG_PRINT("Reference slot %d\n", ntohs(rec->slot));
+    rec->tag = COMPRESS_REC_REF;
+  }
+
+  return size;
+}
+
+int compress_encode(struct compress_dict *dict, uint32_t *epoch,
+                    char *dest, int dest_size,
+                    const char *src, int len) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  if ((now.tv_sec - dict->start.tv_sec) >= dict->keyframe) {
+    // Keyframe, all names are sent in full again
+    DEBUG_COMMENT("Starting new dictionary epoch\n");
+    compress_next_epoch(dict);
+    dict->start = now;
+  }
+  *epoch = dict->epoch;
+
+  int pos = 0;
+  int pos_dest = 0;
+  while (pos < len) {
+    const struct ca_proto_msg *msg = (const struct ca_proto_msg *)(src + pos);
+    int _len = len - pos;
+    if ((uint8_t)src[pos] == PVA_MAGIC) {
+      // pvAccess messages are sent as is
+      int frame = pva_message_len(src + pos, _len);
+      if (frame > 0) {
+        _len = frame;
+      }
+    } else if (_len >= (int)sizeof(struct ca_proto_msg)) {
+      int frame = sizeof(struct ca_proto_msg) + ntohs(msg->payload_size);
+      if (frame < _len) {
+        _len = frame;
+      }
+    }
+
+    int _pos_dest;
+    if ((_len > (int)sizeof(struct ca_proto_search)) &&
+        (_len - (int)sizeof(struct ca_proto_search) < EPICS_PV_MAX_LEN) &&
+        (ntohs(msg->command) == CA_PROTO_SEARCH)) {
+      _pos_dest = compress_put_search(dict, dest + pos_dest,
+                                      dest_size - pos_dest,
+                                      src + pos, _len);
+    } else {
+      _pos_dest = compress_put_raw(dest + pos_dest, dest_size - pos_dest,
+                                   src + pos, _len);
+    }
+
+    if (_pos_dest < 0) {
+      // Out of space. Names defined so far will never reach the
+      // emitter so start a new epoch and let the caller send raw.
+      DEBUG_COMMENT("Compressed packet too large\n");
+      compress_next_epoch(dict);
+      return 0;
+    }
+
+    pos += _len;
+    pos_dest += _pos_dest;
+  }
+
+  DEBUG_PRINT("Compressed %d bytes to %d bytes\n", len, pos_dest);
+  return pos_dest;
+}
+
+int compress_decode(struct compress_dict *dict, uint32_t epoch,
+                    char *dest, int dest_size,
+                    const char *src, int len) {
+  if (dict->epoch != epoch) {
+    // Entries from any other epoch are now stale
+    DEBUG_PRINT("New dictionary epoch 0x%x\n", epoch);
+    dict->epoch = epoch;
+  }
+
+  int pos = 0;
+  int pos_dest = 0;
+  int search = 0;
+  int resolved = 0;
+
+  while (pos < len) {
+    uint8_t tag = src[pos];
+
+    if (tag == COMPRESS_REC_RAW) {
+      if (len - pos < (int)sizeof(struct compress_rec_raw)) {
+        goto _error;
+      }
+      const struct compress_rec_raw *rec =
+        (const struct compress_rec_raw *)(src + pos);
+      int _len = ntohs(rec->len);
+      pos += sizeof(struct compress_rec_raw);
+      if ((_len > len - pos) || (_len > dest_size - pos_dest)) {
+        goto _error;
+      }
+      memcpy(dest + pos_dest, src + pos, _len);
+      pos += _len;
+      pos_dest += _len;
+      continue;
+    }
+
+    if ((tag != COMPRESS_REC_DEFINE) && (tag != COMPRESS_REC_REF)) {
+      goto _error;
+    }
+
+    if (len - pos < (int)sizeof(struct compress_rec_search)) {
+      goto _error;
+    }
+
+    const struct compress_rec_search *rec =
+      (const struct compress_rec_search *)(src + pos);
+    struct compress_dict_entry *entry =
+      &dict->entry[ntohs(rec->slot) & (COMPRESS_DICT_SIZE - 1)];
+    pos += sizeof(struct compress_rec_search);
+    search++;
+
+    if (tag == COMPRESS_REC_DEFINE) {
+      if (pos >= len) {
+        goto _error;
+      }
+      int name_len = (uint8_t)src[pos++];
+      if ((name_len > len - pos) || (name_len >= EPICS_PV_MAX_LEN) ||
+          ((ntohl(rec->check) >> 20) != (uint32_t)name_len)) {
+        goto _error;
+      }
+      entry->epoch = epoch;
+      entry->check = ntohl(rec->check);
+      entry->len = name_len;
+      memcpy(entry->name, src + pos, name_len);
+      pos += name_len;
+    } else if ((entry->epoch != epoch) ||
+               (entry->check != ntohl(rec->check))) {
+      // The definition was lost, drop this search. The client
+      // will retry and the next keyframe defines it again.
+      DEBUG_PRINT("Unresolved slot %d\n", ntohs(rec->slot));
+      continue;
+    }
+
+    int _len = sizeof(struct ca_proto_search) + entry->len;
+    if (_len > dest_size - pos_dest) {
+      goto _error;
+    }
+
+    struct ca_proto_search *req = (struct ca_proto_search *)(dest + pos_dest);
+    req->command = htons(CA_PROTO_SEARCH);
+    req->payload_size = htons(entry->len);
+    req->reply = rec->reply;
+    req->version = rec->version;
+    req->cid1 = rec->cid1;
+    req->cid2 = rec->cid2;
+    memcpy(dest + pos_dest + sizeof(struct ca_proto_search),
+           entry->name, entry->len);
+
+    pos_dest += _len;
+    resolved++;
+  }
+
+  if (search && !resolved) {
+    DEBUG_COMMENT("No search requests could be resolved\n");
+    return 0;
+  }
+
+  return pos_dest;
+
+_error:
+  ERROR_PRINT("Malformed compressed payload at offset %d\n", pos);
+  return 0;
+}
+
+struct compress_dict* compress_peer_dict(struct compress_peer *peers,
+                                         struct sockaddr_in *addr) {
+  int empty = -1;
+  for (int i = 0; i < COMPRESS_MAX_PEERS; i++) {
+    if (peers[i].dict == NULL) {
+      if (empty < 0) {
+        empty = i;
+      }
+      continue;
+    }
+    if ((peers[i].addr.s_addr == addr->sin_addr.s_addr) &&
+        (peers[i].port == addr->sin_port)) {
+      return peers[i].dict;
+    }
+  }
+
+  if (empty < 0) {
+    // Table is full, recycle a slot
+    empty = ntohl(addr->sin_addr.s_addr) % COMPRESS_MAX_PEERS;
+    compress_dict_free(peers[empty].dict);
+  }
+
+  peers[empty].dict = compress_dict_create(0);
+  if (peers[empty].dict == NULL) {
+    return NULL;
+  }
+  peers[empty].addr = addr->sin_addr;
+  peers[empty].port = addr->sin_port;
+
+  return peers[empty].dict;
+}
@@ -0,0 +1,105 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef SRC_COMPRESS_H_
+#define SRC_COMPRESS_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "epics.h"
+
+#define COMPRESS_DICT_SIZE        4096  // Must be a power of 2
+#define COMPRESS_KEYFRAME         10    // Default keyframe interval (s)
+#define COMPRESS_MAX_PEERS        16
+
+#define COMPRESS_REC_RAW          0x00
+#define COMPRESS_REC_DEFINE       0x01
+#define COMPRESS_REC_REF          0x02
+
+// Record headers on the relay link. A RAW record is followed by
+// len bytes of CA message, a DEFINE record by a single length byte
+// and the padded PV name.
+
+struct compress_rec_raw {
+  uint8_t tag;
+  uint16_t len;
+} __attribute__((__packed__));
+
+struct compress_rec_search {
+  uint8_t tag;
+  uint16_t slot;
+  uint32_t check;
+  uint16_t reply;
+  uint16_t version;
+  uint32_t cid1;
+  uint32_t cid2;
+} __attribute__((__packed__));
+
+struct compress_dict_entry {
+  uint32_t epoch;
+  uint32_t check;
+  uint8_t len;
+  char name[EPICS_PV_MAX_LEN];
+};
+
+struct compress_dict {
+  uint32_t epoch;
+  int keyframe;
+  struct timespec start;
+  struct compress_dict_entry entry[COMPRESS_DICT_SIZE];
+};
+
+struct compress_peer {
+  struct in_addr addr;
+  uint16_t port;
+  struct compress_dict *dict;
+};
+
+struct compress_dict* compress_dict_create(int keyframe);
+void compress_dict_free(struct compress_dict *dict);
+int compress_encode(struct compress_dict *dict, uint32_t *epoch,
+                    char *dest, int dest_size,
+                    const char *src, int len);
+int compress_decode(struct compress_dict *dict, uint32_t epoch,
+                    char *dest, int dest_size,
+                    const char *src, int len);
+struct compress_dict* compress_peer_dict(struct compress_peer *peers,
+                                         struct sockaddr_in *addr);
+
+#endif  // SRC_COMPRESS_H_
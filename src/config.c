@@ -37,12 +37,16 @@
 //
 
 #include <sys/socket.h>
-#include <netdb.h>
+#include <arpa/inet.h>
 #include <libconfig.h>
 
 #include "config.h"
+#include "bundle.h"
+#include "resolver.h"
 #include "collector.h"
+#include "pipeline.h"
 #include "emitter.h"
+#include "hub.h"
 #include "debug.h"
 #include "proto.h"
 #include "defs.h"
@@ -57,29 +61,232 @@ int config_open_file(const char* filename, config_t *cfg) {
   return 0;
 }
 
-int config_read_emitter(const char* filename, emitter_params *params) {
-  config_t cfg;
-  config_setting_t *root, *emitter;
+int config_read_multicast(config_setting_t *multicast,
+                          struct sockaddr_in *addr) {
   const char *str;
+  int port;
 
-  DEBUG_PRINT("Config file : %s\n", filename);
+  if (!config_setting_lookup_string(multicast, "group", &str)) {
+    ERROR_COMMENT("You must specify a multicast group\n");
+    return -1;
+  }
 
-  config_init(&cfg);
+  memset(addr, 0, sizeof(struct sockaddr_in));
+  addr->sin_family = AF_INET;
+  if (!inet_aton(str, &(addr->sin_addr)) ||
+      !IN_MULTICAST(ntohl(addr->sin_addr.s_addr))) {
+    ERROR_PRINT("Invalid multicast group : %s\n", str);
+    return -1;
+  }
 
-  if (config_open_file(filename, &cfg)) {
-    goto _error;
+  if (!config_setting_lookup_int(multicast, "port", &port)) {
+    port = PROTO_UDP_PORT;
   }
+  addr->sin_port = htons(port);
 
-  DEBUG_PRINT("Opened config file : %s\n", filename);
+  return 0;
+}
 
-  root = config_root_setting(&cfg);
+int config_read_shm(config_setting_t *shm, char *name, size_t name_len,
+                    int *slots) {
+  const char *str;
 
-  emitter = config_setting_get_member(root, "emitter");
-  if (!emitter) {
-    ERROR_PRINT("Missing \"emitter\" element in %s\n", filename);
-    goto _error;
+  if (!config_setting_lookup_string(shm, "name", &str)) {
+    ERROR_COMMENT("You must specify a shared memory name\n");
+    return -1;
+  }
+  strncpy(name, str, name_len);
+  name[name_len - 1] = '\0';
+
+  if (!config_setting_lookup_int(shm, "slots", slots)) {
+    *slots = RING_SLOTS;
+  }
+
+  if ((*slots <= 0) || (*slots & (*slots - 1))) {
+    ERROR_PRINT("Shared memory slots %d is not a power of 2\n", *slots);
+    return -1;
+  }
+
+  return 0;
+}
+
+int config_read_stats(config_setting_t *section,
+                      struct stats_config *config) {
+  config_setting_t *stats;
+  const char *str;
+
+  memset(config, 0, sizeof(struct stats_config));
+
+  // Receive buffers grow on drops up to rcvbuf_max
+  if (!config_setting_lookup_int(section, "rcvbuf", &(config->rcvbuf)) ||
+      (config->rcvbuf < 0)) {
+    config->rcvbuf = 0;
+  }
+  if (!config_setting_lookup_int(section, "rcvbuf_max",
+                                 &(config->rcvbuf_max)) ||
+      (config->rcvbuf_max < 0)) {
+    config->rcvbuf_max = STATS_RCVBUF_MAX;
+  }
+
+  if (!(stats = config_setting_get_member(section, "stats"))) {
+    // Counters are kept but not exported
+    return 0;
+  }
+
+  if (!config_setting_lookup_string(stats, "address", &str)) {
+    str = "127.0.0.1";
+  }
+  strncpy(config->address, str, sizeof(config->address) - 1);
+
+  if (!config_setting_lookup_int(stats, "port", &(config->port))) {
+    config->port = 0;
+  }
+
+  if (config_setting_lookup_string(stats, "socket", &str)) {
+    strncpy(config->path, str, sizeof(config->path) - 1);
+  }
+
+  if (!config->port && !config->path[0]) {
+    ERROR_COMMENT("Stats needs a port or a socket\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int config_read_recorder(config_setting_t *section,
+                         collector_params *params) {
+  config_setting_t *recorder;
+  const char *str;
+  int minutes, rate;
+
+  params->recorder_file[0] = '\0';
+  if (!(recorder = config_setting_get_member(section, "recorder"))) {
+    return 0;
+  }
+
+  if (!config_setting_lookup_string(recorder, "file", &str)) {
+    ERROR_COMMENT("You must specify a recorder file\n");
+    return -1;
+  }
+  strncpy(params->recorder_file, str, sizeof(params->recorder_file) - 1);
+  params->recorder_file[sizeof(params->recorder_file) - 1] = '\0';
+
+  // The file holds minutes of traffic at the given rate
+  if (!config_setting_lookup_int(recorder, "minutes", &minutes)) {
+    minutes = RECORDER_MINUTES;
+  }
+  if (!config_setting_lookup_int(recorder, "rate", &rate)) {
+    rate = RECORDER_RATE;
+  }
+  if (!config_setting_lookup_int(recorder, "snaplen",
+                                 &(params->recorder_snaplen))) {
+    params->recorder_snaplen = RECORDER_SNAPLEN;
+  }
+
+  if ((minutes <= 0) || (rate <= 0) || (params->recorder_snaplen <= 0) ||
+      (params->recorder_snaplen > PROTO_BUF_SIZE)) {
+    ERROR_COMMENT("Invalid recorder minutes, rate or snaplen\n");
+    return -1;
+  }
+  params->recorder_records = (uint64_t)minutes * 60 * rate;
+
+  return 0;
+}
+
+int config_read_pipeline(config_setting_t *section,
+                         collector_params *params) {
+  config_setting_t *pipeline;
+
+  params->pipeline_workers = 0;
+  if (!(pipeline = config_setting_get_member(section, "pipeline"))) {
+    return 0;
+  }
+
+  if (!config_setting_lookup_int(pipeline, "workers",
+                                 &(params->pipeline_workers))) {
+    params->pipeline_workers = 1;
+  }
+  if (!config_setting_lookup_int(pipeline, "slots",
+                                 &(params->pipeline_slots))) {
+    params->pipeline_slots = PIPELINE_SLOTS;
+  }
+  if (!config_setting_lookup_int(pipeline, "batch",
+                                 &(params->pipeline_batch))) {
+    params->pipeline_batch = PIPELINE_BATCH;
+  }
+
+  if ((params->pipeline_workers <= 0) ||
+      (params->pipeline_workers > PIPELINE_MAX_WORKERS)) {
+    ERROR_PRINT("Pipeline workers must be 1 to %d\n",
+                PIPELINE_MAX_WORKERS);
+    return -1;
+  }
+  if ((params->pipeline_slots <= 0) ||
+      (params->pipeline_slots & (params->pipeline_slots - 1))) {
+    ERROR_PRINT("Pipeline slots %d is not a power of 2\n",
+                params->pipeline_slots);
+    return -1;
+  }
+  if ((params->pipeline_batch <= 0) ||
+      (params->pipeline_batch > PIPELINE_MAX_BATCH)) {
+    ERROR_PRINT("Pipeline batch must be 1 to %d\n", PIPELINE_MAX_BATCH);
+    return -1;
+  }
+
+  return 0;
+}
+
+int config_read_filter(config_setting_t *regex,
+                       struct epics_pv_filter *filter) {
+  filter->next = NULL;
+  filter->sense = 0;
+  filter->logic = 0;
+
+  if (!regex) {
+    // No regex list
+    return 0;
+  }
+
+  // Get rules
+  config_setting_t *rules;
+  if (!(rules = config_setting_get_member(regex, "rules"))) {
+    ERROR_COMMENT("Rules missing from config file\n");
+    return -1;
+  }
+
+  if (!config_setting_is_list(rules)) {
+    ERROR_COMMENT("Rules must be a list\n");
+    return -1;
+  }
+
+  struct epics_pv_filter_elem **current = &(filter->next);
+  for (int i = 0; i < config_setting_length(rules); i++) {
+    const char* rule = config_setting_get_string_elem(rules, i);
+    *current = epics_filter_add(rule);
+    if (*current == NULL) {
+      ERROR_COMMENT("Error setting regex rule\n");
+      return -1;
+    }
+    current = &((*current)->next);
+  }
+
+  // Process regex list
+  if (!config_setting_lookup_bool(regex, "sense", &(filter->sense))) {
+    filter->sense = 0;
   }
+  if (!config_setting_lookup_bool(regex, "logic", &(filter->logic))) {
+    filter->logic = 0;
+  }
+
+  return 0;
+}
 
+int config_parse_emitter(config_setting_t *emitter, emitter_params *params) {
+  config_setting_t *multicast, *shm;
+  const char *str;
+
+  params->iface_name[0] = '\0';
   if (!config_setting_lookup_string(emitter, "interface", &str)) {
     get_interface(NULL, &(params->iface));
   } else {
@@ -87,6 +294,7 @@ int config_read_emitter(const char* filename, emitter_params *params) {
       ERROR_PRINT("Unable to get iface data for %s\n", str);
       goto _error;
     }
+    strncpy(params->iface_name, str, sizeof(params->iface_name) - 1);
   }
 
 
@@ -105,6 +313,61 @@ int config_read_emitter(const char* filename, emitter_params *params) {
     params->port = PROTO_UDP_PORT;
   }
 
+  params->mcast = 0;
+  if ((multicast = config_setting_get_member(emitter, "multicast"))) {
+    if (config_read_multicast(multicast, &(params->mcast_addr))) {
+      goto _error;
+    }
+    params->mcast = 1;
+    params->port = ntohs(params->mcast_addr.sin_port);
+  }
+
+  if (config_read_stats(emitter, &(params->stats))) {
+    goto _error;
+  }
+
+  // Local collector on the same host
+  params->shm = 0;
+  if ((shm = config_setting_get_member(emitter, "shm"))) {
+    if (config_read_shm(shm, params->shm_name, sizeof(params->shm_name),
+                        &(params->shm_slots))) {
+      goto _error;
+    }
+    params->shm = 1;
+  }
+
+  return 0;
+
+_error:
+  return -1;
+}
+
+int config_read_emitter(const char* filename, emitter_params *params) {
+  config_t cfg;
+  config_setting_t *root, *emitter;
+
+  DEBUG_PRINT("Config file : %s\n", filename);
+
+  config_init(&cfg);
+
+  if (config_open_file(filename, &cfg)) {
+    goto _error;
+  }
+
+  DEBUG_PRINT("Opened config file : %s\n", filename);
+
+  root = config_root_setting(&cfg);
+
+  emitter = config_setting_get_member(root, "emitter");
+  if (!emitter) {
+    ERROR_PRINT("Missing \"emitter\" element in %s\n", filename);
+    goto _error;
+  }
+
+  if (config_parse_emitter(emitter, params)) {
+    goto _error;
+  }
+
   config_destroy(&cfg);
   return 0;
 
@@ -114,18 +377,135 @@ _error:
 }
 
 
-int config_read_collector(const char* filename, collector_params *params) {
-  config_t cfg;
-  config_setting_t *root, *collector, *regex, *emitter;
+struct epics_filter_set* config_parse_filter_set(config_setting_t *collector,
+                                                collector_params *params) {
+  config_setting_t *emitter, *multicast, *shm;
+  struct epics_filter_set *filters;
   const char *str;
 
+  // Destinations must match the ones already set up
+  int num_emitter = 0;
+  if ((emitter = config_setting_get_member(collector, "emitter"))) {
+    num_emitter = config_setting_length(emitter);
+  }
+  multicast = config_setting_get_member(collector, "multicast");
+  shm = config_setting_get_member(collector, "shm");
+  if ((num_emitter + (multicast != NULL) + (shm != NULL)) != params->num_fd) {
+    ERROR_COMMENT("Emitter list does not match the running collector\n");
+    return NULL;
+  }
+
+  // A precompiled bundle replaces all regex blocks
+  if (config_setting_lookup_string(collector, "bundle", &str)) {
+    if (config_setting_get_member(collector, "regex")) {
+      NOTICE_PRINT("Using filter bundle %s, regex blocks are ignored\n",
+                   str);
+    }
+    return bundle_read(str, params->num_fd);
+  }
+
+  filters = calloc(1, sizeof(struct epics_filter_set));
+  if (!filters) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return NULL;
+  }
+
+  config_setting_t *regex = config_setting_get_member(collector, "regex");
+  if (config_read_filter(regex, &(filters->global))) {
+    goto _error;
+  }
+
+  // Per emitter regex lists
+  int num_filter = 0;
+  for (int i = 0; i < num_emitter; i++) {
+    config_setting_t *_emitter = config_setting_get_elem(emitter, i);
+    if (config_setting_get_member(_emitter, "regex")) {
+      num_filter++;
+    }
+  }
+  if (multicast && config_setting_get_member(multicast, "regex")) {
+    num_filter++;
+  }
+  if (shm && config_setting_get_member(shm, "regex")) {
+    num_filter++;
+  }
+
+  if (num_filter) {
+    if (params->num_fd > EPICS_MAX_DEST) {
+      ERROR_PRINT("Per emitter regex supports at most %d emitters\n",
+                  EPICS_MAX_DEST);
+      goto _error;
+    }
+
+    filters->dest = calloc(params->num_fd, sizeof(struct epics_pv_filter));
+    if (!filters->dest) {
+      ERROR_COMMENT("Unable to allocate memory\n");
+      goto _error;
+    }
+    filters->num_dest = params->num_fd;
+
+    for (int i = 0; i < params->num_fd; i++) {
+      config_setting_t *_emitter;
+      if (i < num_emitter) {
+        _emitter = config_setting_get_elem(emitter, i);
+      } else if (multicast && (i == num_emitter)) {
+        _emitter = multicast;
+      } else {
+        _emitter = shm;
+      }
+      regex = config_setting_get_member(_emitter, "regex");
+      if (config_read_filter(regex, &(filters->dest[i]))) {
+        goto _error;
+      }
+    }
+  }
+
+  return filters;
+
+_error:
+  epics_filter_set_free(filters);
+  return NULL;
+}
+
+struct epics_filter_set* config_read_filter_set(const char* filename,
+                                                collector_params *params) {
+  config_t cfg;
+  config_setting_t *root, *collector;
+  struct epics_filter_set *filters = NULL;
+
   config_init(&cfg);
 
   if (config_open_file(filename, &cfg)) {
     goto _error;
   }
 
-  DEBUG_PRINT("Opened config file : %s\n", filename);
+  root = config_root_setting(&cfg);
+
+  collector = config_setting_get_member(root, "collector");
+  if (!collector) {
+    ERROR_PRINT("Missing \"collector\" element in %s\n", filename);
+    goto _error;
+  }
+
+  filters = config_parse_filter_set(collector, params);
+
+_error:
+  config_destroy(&cfg);
+  return filters;
+}
+
+struct epics_filter_set* config_read_rules(const char* filename,
+                                           int *num_dest) {
+  config_t cfg;
+  config_setting_t *root, *collector, *emitter;
+  struct epics_filter_set *filters = NULL;
+  collector_params params;
+
+  config_init(&cfg);
+
+  if (config_open_file(filename, &cfg)) {
+    goto _error;
+  }
 
   root = config_root_setting(&cfg);
 
@@ -135,6 +515,34 @@ int config_read_collector(const char* filename, collector_params *params) {
     goto _error;
   }
 
+  if (config_setting_get_member(collector, "bundle")) {
+    ERROR_PRINT("%s loads a bundle, give the file with the rules\n",
+                filename);
+    goto _error;
+  }
+
+  // Destinations are counted as config_parse_collector() sets them up
+  params.num_fd = 0;
+  if ((emitter = config_setting_get_member(collector, "emitter"))) {
+    params.num_fd = config_setting_length(emitter);
+  }
+  params.num_fd += (config_setting_get_member(collector, "multicast") != NULL);
+  params.num_fd += (config_setting_get_member(collector, "shm") != NULL);
+  *num_dest = params.num_fd;
+
+  filters = config_parse_filter_set(collector, &params);
+
+_error:
+  config_destroy(&cfg);
+  return filters;
+}
+
+int config_parse_collector(config_setting_t *collector,
+                           collector_params *params) {
+  config_setting_t *emitter, *multicast, *shm;
+  const char *str;
+
+  params->iface_name[0] = '\0';
   if (!config_setting_lookup_string(collector, "interface", &str)) {
     get_interface(NULL, &(params->iface));
   } else {
@@ -142,8 +550,10 @@ int config_read_collector(const char* filename, collector_params *params) {
       ERROR_PRINT("Unable to get iface data for %s\n", str);
       goto _error;
     }
+    strncpy(params->iface_name, str, sizeof(params->iface_name) - 1);
   }
 
+  params->iface_listen_name[0] = '\0';
   if (!config_setting_lookup_string(collector, "epics_interface", &str)) {
     get_interface(NULL, &(params->iface_listen));
   } else {
@@ -151,16 +561,39 @@ int config_read_collector(const char* filename, collector_params *params) {
       ERROR_PRINT("Unable to get iface data for %s\n", str);
       goto _error;
     }
+    strncpy(params->iface_listen_name, str,
+            sizeof(params->iface_listen_name) - 1);
   }
 
   // Emitter hostname
-  if (!(emitter = config_setting_get_member(collector, "emitter"))) {
-    ERROR_COMMENT("Unable to find emitter list\n");
+  int num_emitter = 0;
+  if ((emitter = config_setting_get_member(collector, "emitter"))) {
+    num_emitter = config_setting_length(emitter);
+  }
+
+  // Multicast group is sent to as an extra emitter
+  params->mcast = 0;
+  if ((multicast = config_setting_get_member(collector, "multicast"))) {
+    params->mcast = 1;
+  }
+
+  // Shared memory ring to an emitter on this host is the last one
+  params->shm = 0;
+  if ((shm = config_setting_get_member(collector, "shm"))) {
+    if (config_read_shm(shm, params->shm_name, sizeof(params->shm_name),
+                        &(params->shm_slots))) {
+      goto _error;
+    }
+    params->shm = 1;
+  }
+
+  if (!num_emitter && !params->mcast && !params->shm) {
+    ERROR_COMMENT("Unable to find emitter list, multicast group or shm\n");
     goto _error;
   }
 
   // Allocate memory
-  params->num_fd = config_setting_length(emitter);
+  params->num_fd = num_emitter + params->mcast + params->shm;
   params->fd = (int *)malloc(sizeof(int) * params->num_fd);
   if (!params->fd) {
     ERROR_COMMENT("Unable to allocate memory\n");
@@ -179,7 +612,19 @@ int config_read_collector(const char* filename, collector_params *params) {
     goto _error;
   }
 
-  for (int i = 0; i < params->num_fd; i++) {
+  params->hostname = calloc(params->num_fd, sizeof(char *));
+  if (!params->hostname) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    goto _error;
+  }
+
+  if (!config_setting_lookup_int(collector, "resolve_interval",
+                                 &(params->resolve_interval)) ||
+      (params->resolve_interval <= 0)) {
+    params->resolve_interval = RESOLVER_INTERVAL;
+  }
+
+  for (int i = 0; i < num_emitter; i++) {
     config_setting_t *_emitter = config_setting_get_elem(emitter, i);
     if (!_emitter) {
       ERROR_COMMENT("Error getting emitter element\n");
@@ -191,64 +636,300 @@ int config_read_collector(const char* filename, collector_params *params) {
       goto _error;
     }
 
-    // Convert hostname to IP
-    struct hostent *he = gethostbyname(str);
-    if (he == NULL) {
-      ERROR_PRINT("Invalid hostname : %s\n", str);
-      goto _error;
-    }
-
-    // Emitter setup
+    // Emitter setup, names are resolved later by the resolver thread
+    // and the emitter is skipped until then
     memset(&(params->emitter_addr[i]), 0, sizeof(struct sockaddr_in));
     params->emitter_addr[i].sin_family = AF_INET;
-    params->emitter_addr[i].sin_port = htons(PROTO_UDP_PORT);
-    params->emitter_addr[i].sin_addr = *((struct in_addr*)he->h_addr);
+    if (!inet_aton(str, &(params->emitter_addr[i].sin_addr))) {
+      if (!(params->hostname[i] = strdup(str))) {
+        ERROR_COMMENT("Unable to allocate memory\n");
+        goto _error;
+      }
+    }
 
     // Now get port
 
     if (!config_setting_lookup_int(_emitter, "port", &(params->port[i]))) {
       params->port[i] = PROTO_UDP_PORT;
     }
+    params->emitter_addr[i].sin_port = htons(params->port[i]);
   }
 
-  // Get regex list
-  if (!(regex = config_setting_get_member(collector, "regex"))) {
-    // No regex list
-    params->filter.next = NULL;
-    params->filter.sense = 0;
-    params->filter.logic = 0;
-  } else {
-    // Get rules
-    config_setting_t *rules;
-    if (!(rules = config_setting_get_member(regex, "rules"))) {
-      ERROR_COMMENT("Rules missing from config file\n");
+  if (params->mcast) {
+    int i = num_emitter;
+    if (config_read_multicast(multicast, &(params->emitter_addr[i]))) {
       goto _error;
     }
+    params->port[i] = ntohs(params->emitter_addr[i].sin_port);
 
-    if (!config_setting_is_list(rules)) {
-      ERROR_COMMENT("Rules must be a list\n");
-      goto _error;
+    if (!config_setting_lookup_int(multicast, "ttl",
+                                   &(params->mcast_ttl))) {
+      params->mcast_ttl = 1;
     }
 
-    struct epics_pv_filter_elem **current = &(params->filter.next);
-    for (int i = 0; i < config_setting_length(rules); i++) {
-      const char* rule = config_setting_get_string_elem(rules, i);
-      *current = epics_filter_add(rule);
-      if (current == NULL) {
-        ERROR_COMMENT("Error setting regex rule\n");
+    if (!config_setting_lookup_string(multicast, "interface", &str)) {
+      params->mcast_iface = params->iface.address;
+    } else {
+      struct ifdatav4 iface;
+      if (get_interface(str, &iface)) {
+        ERROR_PRINT("Unable to get iface data for %s\n", str);
         goto _error;
       }
-      current = &((*current)->next);
+      params->mcast_iface = iface.address;
     }
+  }
+
+  if (params->shm) {
+    int i = params->num_fd - 1;
+    memset(&(params->emitter_addr[i]), 0, sizeof(struct sockaddr_in));
+    params->port[i] = 0;
+  }
+
+  // Get regex lists
+  if (!(params->filter = config_parse_filter_set(collector, params))) {
+    goto _error;
+  }
+
+  if (config_read_stats(collector, &(params->stats))) {
+    goto _error;
+  }
+
+  if (config_read_recorder(collector, params)) {
+    goto _error;
+  }
 
-    // Process regex list
-    if (!config_setting_lookup_bool(regex, "sense",
-                                    &(params->filter.sense))) {
-      params->filter.sense = 0;
+  if (config_read_pipeline(collector, params)) {
+    goto _error;
+  }
+
+  // Runtime filter control socket
+  params->control[0] = '\0';
+  if (config_setting_lookup_string(collector, "control", &str)) {
+    strncpy(params->control, str, sizeof(params->control) - 1);
+    params->control[sizeof(params->control) - 1] = '\0';
+  }
+
+  // Dictionary compression of the relay link
+  if (!config_setting_lookup_bool(collector, "compress",
+                                  &(params->compress))) {
+    params->compress = 0;
+  }
+  if (!config_setting_lookup_int(collector, "keyframe",
+                                 &(params->keyframe))) {
+    params->keyframe = COMPRESS_KEYFRAME;
+  }
+
+  return 0;
+
+_error:
+  return -1;
+}
+
+int config_read_collector(const char* filename, collector_params *params) {
+  config_t cfg;
+  config_setting_t *root, *collector;
+
+  config_init(&cfg);
+
+  if (config_open_file(filename, &cfg)) {
+    goto _error;
+  }
+
+  DEBUG_PRINT("Opened config file : %s\n", filename);
+
+  root = config_root_setting(&cfg);
+
+  collector = config_setting_get_member(root, "collector");
+  if (!collector) {
+    ERROR_PRINT("Missing \"collector\" element in %s\n", filename);
+    goto _error;
+  }
+
+  if (config_parse_collector(collector, params)) {
+    goto _error;
+  }
+
+  config_destroy(&cfg);
+  return 0;
+
+_error:
+  config_destroy(&cfg);
+  return -1;
+}
+
+int config_read_relay(const char* filename, collector_params *collector,
+                      emitter_params *emitter) {
+  config_t cfg;
+  config_setting_t *root, *_collector, *_emitter;
+
+  config_init(&cfg);
+
+  if (config_open_file(filename, &cfg)) {
+    goto _error;
+  }
+
+  DEBUG_PRINT("Opened config file : %s\n", filename);
+
+  root = config_root_setting(&cfg);
+
+  // Both roles are read from the one parse of the file
+  _collector = config_setting_get_member(root, "collector");
+  _emitter = config_setting_get_member(root, "emitter");
+  if (!_collector || !_emitter) {
+    ERROR_PRINT("Missing \"collector\" or \"emitter\" element in %s\n",
+                filename);
+    goto _error;
+  }
+
+  if (config_parse_collector(_collector, collector)) {
+    goto _error;
+  }
+
+  if (config_parse_emitter(_emitter, emitter)) {
+    goto _error;
+  }
+
+  config_destroy(&cfg);
+  return 0;
+
+_error:
+  config_destroy(&cfg);
+  return -1;
+}
+
+int config_find_iface(hub_params *params, const char *name) {
+  for (int i = 0; i < params->num_iface; i++) {
+    if (!strcmp(params->iface[i].name, name)) {
+      return i;
     }
-    if (!config_setting_lookup_bool(regex, "logic",
-                                    &(params->filter.logic))) {
-      params->filter.logic = 0;
+  }
+
+  ERROR_PRINT("Unknown interface %s in route\n", name);
+  return -1;
+}
+
+int config_read_hub(const char* filename, hub_params *params) {
+  config_t cfg;
+  config_setting_t *root, *hub, *ifaces, *routes;
+  struct epics_pv_filter filter;
+  const char *str;
+
+  config_init(&cfg);
+
+  if (config_open_file(filename, &cfg)) {
+    goto _error;
+  }
+
+  DEBUG_PRINT("Opened config file : %s\n", filename);
+
+  root = config_root_setting(&cfg);
+
+  hub = config_setting_get_member(root, "hub");
+  if (!hub) {
+    ERROR_PRINT("Missing \"hub\" element in %s\n", filename);
+    goto _error;
+  }
+
+  if (config_read_stats(hub, &(params->stats))) {
+    goto _error;
+  }
+
+  if (!(ifaces = config_setting_get_member(hub, "interfaces"))) {
+    ERROR_COMMENT("Unable to find interface list\n");
+    goto _error;
+  }
+
+  params->num_iface = config_setting_length(ifaces);
+  if ((params->num_iface < 2) || (params->num_iface > HUB_MAX_IFACE)) {
+    ERROR_PRINT("Hub needs between 2 and %d interfaces\n", HUB_MAX_IFACE);
+    goto _error;
+  }
+
+  params->iface = calloc(params->num_iface, sizeof(struct hub_iface));
+  if (!params->iface) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    goto _error;
+  }
+
+  // Global regex list
+  if (config_read_filter(config_setting_get_member(hub, "regex"), &filter)) {
+    goto _error;
+  }
+
+  for (int i = 0; i < params->num_iface; i++) {
+    struct hub_iface *iface = &(params->iface[i]);
+    config_setting_t *_iface = config_setting_get_elem(ifaces, i);
+    if (!_iface) {
+      ERROR_COMMENT("Error getting interface element\n");
+      goto _error;
+    }
+
+    if (!config_setting_lookup_string(_iface, "name", &str)) {
+      ERROR_PRINT("You must specify a name in element %d\n", i);
+      goto _error;
+    }
+
+    if (get_interface(str, &(iface->iface))) {
+      ERROR_PRINT("Unable to get iface data for %s\n", str);
+      goto _error;
+    }
+    strncpy(iface->name, str, sizeof(iface->name));
+
+    iface->filter.global = filter;
+    iface->filter.num_dest = 0;
+    iface->filter.dest = NULL;
+    iface->routes = 0;
+  }
+
+  if (!(routes = config_setting_get_member(hub, "routes"))) {
+    // Relay between all interfaces
+    for (int i = 0; i < params->num_iface; i++) {
+      params->iface[i].routes = (((uint64_t)1 << params->num_iface) - 1) &
+                                ~((uint64_t)1 << i);
+    }
+  } else {
+    for (int i = 0; i < config_setting_length(routes); i++) {
+      config_setting_t *route = config_setting_get_elem(routes, i);
+      const char *to;
+      if (!route ||
+          !config_setting_lookup_string(route, "from", &str) ||
+          !config_setting_lookup_string(route, "to", &to)) {
+        ERROR_PRINT("You must specify from and to in route %d\n", i);
+        goto _error;
+      }
+
+      int src = config_find_iface(params, str);
+      int dst = config_find_iface(params, to);
+      if ((src < 0) || (dst < 0)) {
+        goto _error;
+      }
+      if (src == dst) {
+        ERROR_PRINT("Route %d relays %s onto itself\n", i, str);
+        goto _error;
+      }
+
+      struct hub_iface *iface = &(params->iface[src]);
+      iface->routes |= (uint64_t)1 << dst;
+
+      config_setting_t *regex = config_setting_get_member(route, "regex");
+      if (!regex) {
+        continue;
+      }
+
+      // Route filters are indexed by destination interface
+      if (!iface->filter.dest) {
+        iface->filter.num_dest = params->num_iface;
+        iface->filter.dest = calloc(params->num_iface,
+                                    sizeof(struct epics_pv_filter));
+        if (!iface->filter.dest) {
+          ERROR_COMMENT("Unable to allocate memory\n");
+          goto _error;
+        }
+      }
+
+      if (config_read_filter(regex, &(iface->filter.dest[dst]))) {
+        goto _error;
+      }
     }
   }
 
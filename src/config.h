@@ -41,8 +41,16 @@
 
 #include "collector.h"
 #include "emitter.h"
+#include "hub.h"
 
 int config_read_collector(const char* filename, collector_params *params);
 int config_read_emitter(const char* filename, emitter_params *params);
+int config_read_hub(const char* filename, hub_params *params);
+struct epics_filter_set* config_read_filter_set(const char* filename,
+                                                collector_params *params);
+struct epics_filter_set* config_read_rules(const char* filename,
+                                           int *num_dest);
+int config_read_relay(const char* filename, collector_params *collector,
+                      emitter_params *emitter);
 
 #endif  // SRC_CONFIG_H_
@@ -0,0 +1,258 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "debug.h"
+#include "epics.h"
+#include "collector.h"
+#include "control.h"
+
+static struct epics_pv_filter* control_target(struct epics_filter_set *filters,
+                                              const char *target) {
+  if (!strcmp(target, "global")) {
+    return &(filters->global);
+  }
+
+  char *end;
+  int n = strtol(target, &end, 10);
+  if ((*end != '\0') || (n < 0) || (n >= filters->num_dest)) {
+    return NULL;
+  }
+
+  return &(filters->dest[n]);
+}
+
+static void control_list(struct epics_pv_filter *filter, const char *target,
+                         FILE *out) {
+  for (struct epics_pv_filter_elem *elem = filter->next; elem;
+       elem = elem->next) {
+    fprintf(out, "%s %s\n", target, elem->exp);
+  }
+}
+
+static int control_update(collector_params *params, int add,
+                          const char *target, const char *exp, FILE *out) {
+  struct epics_pv_filter_elem *removed = NULL;
+
+  // Only the rules changed are compiled, the rest are shared
+  struct epics_filter_set *old = params->filter;
+  struct epics_filter_set *filters = epics_filter_set_clone(old);
+  if (!filters) {
+    fprintf(out, "ERROR out of memory\n");
+    return -1;
+  }
+
+  struct epics_pv_filter *filter = control_target(filters, target);
+  if (!filter) {
+    fprintf(out, "ERROR invalid target %s\n", target);
+    epics_filter_set_release(filters);
+    return -1;
+  }
+
+  if (add) {
+    if (epics_filter_insert(filter, exp)) {
+      fprintf(out, "ERROR invalid regex %s\n", exp);
+      epics_filter_set_release(filters);
+      return -1;
+    }
+  } else if (!(removed = epics_filter_remove(filter, exp))) {
+    fprintf(out, "ERROR no rule %s %s\n", target, exp);
+    epics_filter_set_release(filters);
+    return -1;
+  }
+
+  // Publish, then free what the old set no longer shares
+  __atomic_store_n(&(params->filter), filters, __ATOMIC_RELEASE);
+  rcu_synchronize(params->rcu, params->num_rcu);
+  epics_filter_set_release(old);
+  if (removed) {
+    epics_filter_reclaim(removed, exp);
+  }
+
+  NOTICE_PRINT("%s rule %s %s\n", add ? "Added" : "Removed", target, exp);
+
+  return 0;
+}
+
+int control_command(collector_params *params, char *line, FILE *out) {
+  int rc = 0;
+
+  line[strcspn(line, "\r\n")] = '\0';
+  DEBUG_PRINT("Control command : %s\n", line);
+
+  // Split into command, target and the rest of the line as the regex
+  char *cmd = line;
+  char *target = NULL;
+  char *exp = NULL;
+  if ((target = strchr(cmd, ' '))) {
+    *target++ = '\0';
+    if ((exp = strchr(target, ' '))) {
+      *exp++ = '\0';
+    }
+  }
+
+  pthread_mutex_lock(&(params->filter_lock));
+
+  if (!strcmp(cmd, "list")) {
+    struct epics_filter_set *filters = params->filter;
+    control_list(&(filters->global), "global", out);
+    for (int i = 0; i < filters->num_dest; i++) {
+      char _target[16];
+      snprintf(_target, sizeof(_target), "%d", i);
+      control_list(&(filters->dest[i]), _target, out);
+    }
+  } else if ((!strcmp(cmd, "add") || !strcmp(cmd, "del")) &&
+             target && exp && *exp) {
+    rc = control_update(params, !strcmp(cmd, "add"), target, exp, out);
+  } else {
+    fprintf(out, "ERROR invalid command\n");
+    rc = -1;
+  }
+
+  pthread_mutex_unlock(&(params->filter_lock));
+
+  if (!rc) {
+    fprintf(out, "OK\n");
+  }
+  fflush(out);
+
+  return rc;
+}
+
+static void* control_thread(void *arg) {
+  collector_params *params = arg;
+  int fd = params->fd_control;
+
+  for (;;) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      if (errno != EINTR) {
+        ERROR_COMMENT("Control socket accept failed\n");
+      }
+      continue;
+    }
+
+    // Do not let an idle or stuck client hold up the others
+    struct timeval timeout = {CONTROL_TIMEOUT, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // A socket can not be repositioned, so reading and writing go
+    // through their own streams
+    FILE *in = fdopen(client, "r");
+    if (!in) {
+      close(client);
+      continue;
+    }
+
+    int _client = dup(client);
+    FILE *out = (_client >= 0) ? fdopen(_client, "w") : NULL;
+    if (!out) {
+      if (_client >= 0) {
+        close(_client);
+      }
+      fclose(in);
+      continue;
+    }
+
+    // A client gone before its reply (EPIPE) is dropped like one that
+    // closed, SIGPIPE is ignored by the daemon
+    char line[CONTROL_LINE_MAX];
+    while (!ferror(out) && fgets(line, sizeof(line), in)) {
+      control_command(params, line, out);
+    }
+
+    fclose(out);
+    fclose(in);
+  }
+
+  return NULL;
+}
+
+int control_start(collector_params *params) {
+  struct sockaddr_un addr;
+  pthread_t thread;
+
+  if (!params->control[0]) {
+    // Not configured
+    return 0;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(params->control) >= sizeof(addr.sun_path)) {
+    ERROR_PRINT("Control socket path too long : %s\n", params->control);
+    return -1;
+  }
+  strncpy(addr.sun_path, params->control, sizeof(addr.sun_path) - 1);
+
+  if ((params->fd_control = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    ERROR_COMMENT("Unable to create control socket\n");
+    return -1;
+  }
+
+  // Remove a socket left by a previous run
+  unlink(params->control);
+  if (bind(params->fd_control, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(params->fd_control, 4)) {
+    ERROR_PRINT("Unable to bind control socket %s : %s\n", params->control,
+                strerror(errno));
+    close(params->fd_control);
+    return -1;
+  }
+
+  if (pthread_create(&thread, NULL, control_thread, params)) {
+    ERROR_COMMENT("Unable to start control thread\n");
+    close(params->fd_control);
+    return -1;
+  }
+  pthread_detach(thread);
+
+  NOTICE_PRINT("Listening for control commands on %s\n", params->control);
+
+  return 0;
+}
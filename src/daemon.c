@@ -0,0 +1,104 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "stats.h"
+#include "daemon.h"
+
+static sigset_t daemon_sigs;
+
+struct daemon_loop {
+  void* (*loop)(void *);
+  void *arg;
+};
+
+int daemon_signals(void) {
+  // SIGUSR1 is raised by the loop thread when the loop returns
+  sigemptyset(&daemon_sigs);
+  sigaddset(&daemon_sigs, SIGTERM);
+  sigaddset(&daemon_sigs, SIGINT);
+  sigaddset(&daemon_sigs, SIGUSR1);
+  if (pthread_sigmask(SIG_BLOCK, &daemon_sigs, NULL)) {
+    ERROR_COMMENT("Unable to block signals\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void* daemon_thread(void *arg) {
+  struct daemon_loop *loop = arg;
+
+  loop->loop(loop->arg);
+  kill(getpid(), SIGUSR1);
+
+  return NULL;
+}
+
+void daemon_run(void* (*loop)(void *), void *arg) {
+  static struct daemon_loop _loop;
+  pthread_t thread;
+  int sig;
+
+  _loop.loop = loop;
+  _loop.arg = arg;
+  if (pthread_create(&thread, NULL, daemon_thread, &_loop)) {
+    ERROR_COMMENT("Unable to start packet thread\n");
+    exit(-1);
+  }
+  pthread_detach(thread);
+
+  while (sigwait(&daemon_sigs, &sig)) {
+    continue;
+  }
+
+  if (sig == SIGUSR1) {
+    ERROR_COMMENT("Packet loop failed ... exiting\n");
+    stats_dump();
+    exit(-1);
+  }
+
+  NOTICE_COMMENT("Exiting\n");
+  stats_dump();
+  exit(0);
+}
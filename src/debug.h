@@ -40,6 +40,8 @@
 
 #include <stdio.h>
 
+#include "log.h"
+
 extern int debug_flag;
 
 #ifdef SYSTEMD
@@ -59,70 +61,79 @@ extern int debug_flag;
 #define __FILENAME__      __FILE__
 #endif
 
+// Each call site has its own rate limit, debug output is never limited
+#define LOG_MESSAGE(burst, ...) \
+  do { \
+    static struct log_site _log_site = { \
+      .file = __FILENAME__, .line = __LINE__, .limit = (burst) \
+    }; \
+    log_print(&_log_site, __VA_ARGS__); \
+  } while (0)
+
 #ifdef DEBUG
 
 #define DEBUG_PRINT(fmt, ...) \
-  if (debug_flag) fprintf(stderr, SD_DEBUG " %s:%-4d:%s(): " fmt, \
+  if (debug_flag) LOG_MESSAGE(0, SD_DEBUG " %s:%-4d:%s(): " fmt, \
           __FILENAME__, __LINE__, __func__, __VA_ARGS__);
 
 #define DEBUG_COMMENT(txt) \
-  if (debug_flag) fprintf(stderr, SD_DEBUG " %s:%-4d:%s(): %s", \
+  if (debug_flag) LOG_MESSAGE(0, SD_DEBUG " %s:%-4d:%s(): %s", \
           __FILENAME__, __LINE__, __func__, txt);
 
 #define NOTICE_PRINT(fmt, ...) \
-  fprintf(stderr, SD_NOTICE " %s:%-4d:%s(): " fmt, \
+  LOG_MESSAGE(LOG_BURST, SD_NOTICE " %s:%-4d:%s(): " fmt, \
           __FILENAME__, __LINE__, __func__, __VA_ARGS__);
 
 #define NOTICE_COMMENT(txt) \
-  fprintf(stderr, SD_NOTICE " %s:%-4d:%s(): %s", \
+  LOG_MESSAGE(LOG_BURST, SD_NOTICE " %s:%-4d:%s(): %s", \
           __FILENAME__, __LINE__, __func__, txt);
 
 #define ERROR_PRINT(fmt, ...) \
-  fprintf(stderr, SD_ERR " %s:%-4d:%s(): " fmt, \
+  LOG_MESSAGE(LOG_BURST, SD_ERR " %s:%-4d:%s(): " fmt, \
           __FILENAME__, __LINE__, __func__, __VA_ARGS__);
 
 #define ERROR_COMMENT(txt) \
-  fprintf(stderr, SD_ERR " %s:%-4d:%s(): %s", \
+  LOG_MESSAGE(LOG_BURST, SD_ERR " %s:%-4d:%s(): %s", \
           __FILENAME__, __LINE__, __func__, txt);
 
 #define ALERT_PRINT(fmt, ...) \
-  fprintf(stderr, SD_ALERT " %s:%-4d:%s(): " fmt, \
+  LOG_MESSAGE(LOG_BURST, SD_ALERT " %s:%-4d:%s(): " fmt, \
           __FILENAME__, __LINE__, __func__, __VA_ARGS__);
 
 #define ALERT_COMMENT(txt) \
-  fprintf(stderr, SD_ALERT " %s:%-4d:%s(): %s", \
+  LOG_MESSAGE(LOG_BURST, SD_ALERT " %s:%-4d:%s(): %s", \
           __FILENAME__, __LINE__, __func__, txt);
 
 #else
 
 #define DEBUG_PRINT(fmt, ...) \
-  if (debug_flag) fprintf(stderr, SD_DEBUG " " fmt, \
+  if (debug_flag) LOG_MESSAGE(0, SD_DEBUG " " fmt, \
           __VA_ARGS__);
 
 #define DEBUG_COMMENT(txt) \
-  if (debug_flag) fprintf(stderr, SD_DEBUG " %s", txt);
+  if (debug_flag) LOG_MESSAGE(0, SD_DEBUG " %s", txt);
 
 #define NOTICE_PRINT(fmt, ...) \
-  fprintf(stderr, SD_NOTICE " " fmt, \
+  LOG_MESSAGE(LOG_BURST, SD_NOTICE " " fmt, \
           __VA_ARGS__);
 
 #define NOTICE_COMMENT(txt) \
-  fprintf(stderr, SD_NOTICE " %s", txt);
+  LOG_MESSAGE(LOG_BURST, SD_NOTICE " %s", txt);
 
 #define ERROR_PRINT(fmt, ...) \
-  fprintf(stderr, SD_ERR " %s(): " fmt, \
+  LOG_MESSAGE(LOG_BURST, SD_ERR " %s(): " fmt, \
           __func__, __VA_ARGS__);
 
 #define ERROR_COMMENT(txt) \
-  fprintf(stderr, SD_ERR " %s(): %s", \
+  LOG_MESSAGE(LOG_BURST, SD_ERR " %s(): %s", \
           __func__, txt);
 
 #define ALERT_PRINT(fmt, ...) \
-  fprintf(stderr, SD_ERR " %s(): " fmt, \
+  LOG_MESSAGE(LOG_BURST, SD_ERR " %s(): " fmt, \
           __func__, __VA_ARGS__);
 
 #define ALERT_COMMENT(txt) \
-  fprintf(stderr, SD_ALERT " %s", txt);
+  LOG_MESSAGE(LOG_BURST, SD_ALERT " %s", txt);
 
 #endif
 
@@ -39,18 +39,23 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <string.h>
+#include <time.h>
+#include <sys/select.h>
 #include <libnet.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
 #include "debug.h"
+#include "probes.h"
 #include "ethernet.h"
 #include "emitter.h"
 #include "proto.h"
 #include "config.h"
 #include "defs.h"
+#include "stats.h"
+#include "daemon.h"
 
-int debug_flag = 0;
+#ifndef EPICS_RELAY_COMBINED
 extern const char* EPICS_RELAY_GIT_REV;
 extern const char* EPICS_RELAY_GIT_BRANCH;
 extern const char* EPICS_RELAY_GIT_VERSION;
@@ -60,35 +65,16 @@ static struct option long_options[] = {
   {"config", required_argument, 0, 'c'},
   {0, 0, 0, 0}
 };
-
-uint8_t hw_bcast[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+#endif  // EPICS_RELAY_COMBINED
 
 int check_udp_packet(struct ifdatav4 *iface,
                      const unsigned char* buffer, ssize_t len) {
-  // Check packet length
-  if (len <= (ssize_t)sizeof(struct proto_udp_header)) {
-    ERROR_PRINT("Invalid packet length %d\n", len);
+  if (proto_header_check(buffer, len)) {
     return -1;
   }
 
-  struct proto_udp_header *header = (struct proto_udp_header*)buffer;
-
-  // Check magic
-
-  if (header->magic != PROTO_MAGIC_NUMBER) {
-    ERROR_PRINT("Invalid packet magic number 0x%lx\n", header->magic);
-    return -1;
-  }
-
-  if (header->version != PROTO_VERSION) {
-    ERROR_COMMENT("Invalid packet version\n");
-    return -1;
-  }
-
-  if (header->type != PROTO_TYPE) {
-    ERROR_COMMENT("Invalid packet type\n");
-    return -1;
-  }
+  const struct proto_udp_header *header =
+    (const struct proto_udp_header*)buffer;
 
   // Check packet is NOT from subnet
 
@@ -101,115 +87,261 @@ int check_udp_packet(struct ifdatav4 *iface,
   return 0;
 }
 
-void close_libnet(struct libnet_params *params) {
-  libnet_destroy(params->lnet);
+ssize_t decompress_udp_packet(emitter_params *params,
+                              struct sockaddr_in *addr,
+                              unsigned char *dest, ssize_t dest_size,
+                              const unsigned char *src) {
+  struct compress_dict *dict = compress_peer_dict(params->peers, addr);
+  if (dict == NULL) {
+    return 0;
+  }
+
+  return proto_expand_packet(dict, dest, dest_size, src);
 }
 
-int setup_libnet(struct libnet_params *params, const char *iface) {
-#ifdef LIBNET_MODE_LINK
-  DEBUG_COMMENT("LIBNET_LINK\n");
-  params->lnet = libnet_init(LIBNET_LINK, iface, params->errbuf);
-#else
-  DEBUG_COMMENT("LIBNET_RAW4\n");
-  params->lnet = libnet_init(LIBNET_RAW4, iface, params->errbuf);
-#endif
-  if (params->lnet == NULL) {
-    ERROR_PRINT("Error with libnet_init(): %s", params->errbuf);
+int emitter_setup(emitter_params *params) {
+  if (params->shm) {
+    // Packets come from a collector on this host
+    if (!(params->ring = ring_shm_open(params->shm_name, params->shm_slots,
+                                       PROTO_BUF_SIZE))) {
+      return -1;
+    }
+    params->fd = -1;
+    NOTICE_PRINT("Receiving from shared memory %s\n", params->shm_name);
+  } else if (params->mcast) {
+    // Bind to the group so only relay traffic is received
+    if (bind_socket(params->mcast_addr.sin_addr, params->port, 0,
+                    &params->fd) ||
+        multicast_join(params->fd, params->mcast_addr.sin_addr,
+                       params->iface.address)) {
+      ERROR_COMMENT("Unable to join multicast group\n");
+      return -1;
+    }
+  } else if (bind_socket(params->iface.address, params->port, 0,
+                         &params->fd)) {
+    ERROR_COMMENT("Unable to bind to socket\n");
     return -1;
   }
 
-  if ((params->hw_addr = libnet_get_hwaddr(params->lnet)) == NULL) {
-    ERROR_COMMENT("Unable to read HW address.\n");
+  if (!params->shm) {
+    char name[160];
+    snprintf(name, sizeof(name), "%s:%d", params->iface_name, params->port);
+    params->sock = stats_socket(name, &(params->stats));
+    stats_socket_open(params->sock, params->fd);
+  }
+
+  // Setup libnet
+  if (setup_libnet(&params->libnet, params->iface_epics_name)) {
+    ERROR_COMMENT("Unable to setup packet emitter\n");
     return -1;
   }
 
-  DEBUG_PRINT("%s hardware address : %s\n", iface,
-              int_to_mac(params->hw_addr->ether_addr_octet));
+  params->libnet.bcast = params->iface_epics.broadcast;
+  memset(params->peers, 0, sizeof(params->peers));
 
-  params->udp_t = 0;
-  params->ipv4_t = 0;
-  params->eth_t = 0;
+  // Follow address changes, relaying works without it
+  if (iface_monitor_open(&(params->fd_netlink))) {
+    ERROR_COMMENT("Interface changes will not be tracked\n");
+  }
+
+  // Buffers may be provided by the caller to share them with other roles
+  if (!params->buffer) {
+    params->buffer = malloc(PROTO_BUF_SIZE);
+  }
+  if (!params->buffer_dict) {
+    params->buffer_dict = malloc(PROTO_BUF_SIZE);
+  }
+  if (!params->buffer || !params->buffer_dict) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return -1;
+  }
 
   return 0;
 }
 
-int send_udp_packet(struct libnet_params *params,
-                    unsigned char *packet, ssize_t packet_len) {
-  // Check packet length
-  if (packet_len <= (ssize_t)sizeof(struct proto_udp_header)) {
-    ERROR_PRINT("Invalid packet length %d\n", packet_len);
-    return -1;
+void emitter_iface_update(emitter_params *params) {
+  struct in_addr address = params->iface.address;
+
+  if ((iface_refresh(params->iface_name, &(params->iface)) > 0) &&
+      !params->shm && (address.s_addr != params->iface.address.s_addr)) {
+    if (params->mcast) {
+      if (multicast_join(params->fd, params->mcast_addr.sin_addr,
+                         params->iface.address)) {
+        ERROR_COMMENT("Unable to rejoin multicast group\n");
+      }
+    } else if (rebind_socket(params->iface.address, params->port, 0,
+                             &(params->fd))) {
+      ERROR_COMMENT("Unable to rebind relay socket\n");
+    } else {
+      stats_socket_open(params->sock, params->fd);
+    }
   }
 
-  struct proto_udp_header *header = (struct proto_udp_header*)packet;
+  if (iface_refresh(params->iface_epics_name, &(params->iface_epics)) > 0) {
+    // The device may have been recreated, so start libnet again
+    close_libnet(&(params->libnet));
+    if (setup_libnet(&(params->libnet), params->iface_epics_name)) {
+      ERROR_COMMENT("Unable to setup packet emitter\n");
+    }
+    params->libnet.bcast = params->iface_epics.broadcast;
+  }
+}
 
-  DEBUG_PRINT("Payload len = %d\n", header->payload_len);
-  struct in_addr ip;
-  ip.s_addr = header->src_ip;
-  DEBUG_PRINT("Source IP : %s\n", inet_ntoa(ip));
-
-  /* build the ethernet header */
-  params->udp_t = libnet_build_udp(
-    htons(header->src_port),                     // src port
-    htons(header->dst_port),                     // dst port
-    LIBNET_UDP_H + header->payload_len,          // Total packet length
-    0,                                           // checksum (autofill)
-    packet + sizeof(struct proto_udp_header),    // payload
-    header->payload_len,                         // length of payload
-    params->lnet, params->udp_t);
-
-  if (params->udp_t == -1) {
-    ERROR_COMMENT("Unable to create UDP packet\n");
-    return -1;
+int emitter_receive(emitter_params *params) {
+  struct sockaddr_in client_addr;
+  struct timespec ts;
+  uint32_t drops;
+  unsigned char *buffer = params->buffer;
+
+  // Receive client's message:
+  ssize_t rc;
+  if ((rc = recv_timestamp(params->fd, buffer, PROTO_BUF_SIZE,
+                           &client_addr, &ts, &drops)) < 0) {
+    ERROR_COMMENT("Could not receive\n");
+    return 0;
   }
 
-  params->ipv4_t = libnet_build_ipv4(
-    LIBNET_IPV4_H + LIBNET_UDP_H + header->payload_len,   // Total packet length
-    0,                                            // Type of service
-    libnet_get_prand(LIBNET_PRu16),               // Packet id
-    0x4000,                                       // Frag (don't frag)
-    64,                                           // Time to live
-    IPPROTO_UDP,                                  // Protocol
-    0,                                            // Checksum (autofill)
-    header->src_ip,                               // Source IP
-    params->bcast.s_addr,                         // Dest IP
-    NULL, 0,                                      // Payload
-    params->lnet, params->ipv4_t);
-
-  if (params->ipv4_t == -1) {
-    ERROR_COMMENT("Unable to create IPV4 packet\n");
-    return -1;
+  char name[INET_ADDRSTRLEN];
+  stats_inc(STATS_EMITTER_RX);
+  PROBE2(emitter_receive, rc, client_addr.sin_addr.s_addr);
+  stats_drops(params->sock, params->fd, drops, &ts);
+  if (inet_ntop(AF_INET, &(client_addr.sin_addr), name, sizeof(name))) {
+    DEBUG_PRINT("Received message from IP: %s and port: %i\n", name,
+                ntohs(client_addr.sin_port));
+  }
+  if (check_udp_packet(&params->iface_epics, buffer, rc)) {
+    ERROR_COMMENT("Packet check failed ... skipping ...\n");
+    stats_inc(STATS_EMITTER_REJECT);
+    return 0;
+  }
+
+  unsigned char *packet = buffer;
+  if (((struct proto_udp_header*)buffer)->type == PROTO_TYPE_DICT) {
+    rc = decompress_udp_packet(params, &client_addr,
+                               params->buffer_dict, PROTO_BUF_SIZE,
+                               buffer);
+    if (!rc) {
+      DEBUG_COMMENT("Nothing to send after decompression\n");
+      return 0;
+    }
+    packet = params->buffer_dict;
   }
 
-#ifdef LIBNET_MODE_LINK
-  params->eth_t = libnet_build_ethernet(
-    hw_bcast,                                     // Dest hw address
-    (uint8_t*)params->hw_addr,                    // Interface HW Address
-    ETHERTYPE_IP,                                 // Type
-    NULL,                                         // Payload
-    0,                                            // Payload size
-    params->lnet, params->eth_t);
-
-  if (params->eth_t == -1) {
-    ERROR_COMMENT("Unable to create ETH packet\n");
+  if (send_udp_packet(&params->libnet, packet, rc)) {
+    ERROR_COMMENT("Failed to send packet\n");
     return -1;
   }
-#endif
+  stats_inc(STATS_EMITTER_BCAST);
+  stats_latency(STATS_LATENCY_BCAST, &ts);
 
-  // Write the packet and send on the wire
+  return 0;
+}
 
-  if ((libnet_write(params->lnet)) == -1) {
-    ERROR_COMMENT("Unable to write packet.");
-    return -1;
+int emitter_receive_shm(emitter_params *params) {
+  const unsigned char *buffer;
+  uint32_t len;
+
+  // Wake up now and then to look at interface changes
+  struct timespec timeout = {EMITTER_POLL_INTERVAL, 0};
+  if (ring_wait(params->ring, &timeout)) {
+    return 0;
+  }
+
+  // Packets are sent straight from the ring without copying them out
+  while ((buffer = ring_peek(params->ring, &len))) {
+    stats_inc(STATS_EMITTER_RX);
+    PROBE2(emitter_receive, len, 0);
+    if (!check_udp_packet(&params->iface_epics, buffer, len)) {
+      if (send_udp_packet(&params->libnet, (unsigned char *)buffer, len)) {
+        ERROR_COMMENT("Failed to send packet\n");
+        ring_release(params->ring);
+        return -1;
+      }
+      stats_inc(STATS_EMITTER_BCAST);
+    } else {
+      ERROR_COMMENT("Packet check failed ... skipping ...\n");
+      stats_inc(STATS_EMITTER_REJECT);
+    }
+    ring_release(params->ring);
   }
 
   return 0;
 }
 
+#ifndef EPICS_RELAY_COMBINED
+static void* emitter_thread(void *arg) {
+  emitter_params *params = arg;
+
+  struct timespec last, now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &last);
+
+  for (;;) {
+    int rc = 0;
+    int netlink = 0;
+
+    if (params->shm) {
+      rc = emitter_receive_shm(params);
+
+      // The ring is not a descriptor, so poll at most once an interval
+      clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+      if ((now.tv_sec - last.tv_sec) >= EMITTER_POLL_INTERVAL) {
+        netlink = 1;
+        last = now;
+      }
+    } else {
+      fd_set socks;
+      FD_ZERO(&socks);
+      FD_SET(params->fd, &socks);
+      int maxfd = params->fd;
+      if (params->fd_netlink >= 0) {
+        FD_SET(params->fd_netlink, &socks);
+        maxfd = (params->fd_netlink > maxfd) ? params->fd_netlink : maxfd;
+      }
+
+      if (select(maxfd + 1, &socks, NULL, NULL, NULL) < 0) {
+        ERROR_COMMENT("Select failed\n");
+        continue;
+      }
+
+      if (FD_ISSET(params->fd, &socks)) {
+        rc = emitter_receive(params);
+      }
+      netlink = (params->fd_netlink >= 0) &&
+        FD_ISSET(params->fd_netlink, &socks);
+    }
+
+    if (rc) {
+      ERROR_COMMENT("Emitter failed ... exiting\n");
+      break;
+    }
+
+    if (netlink && (params->fd_netlink >= 0) &&
+        (iface_monitor_read(params->fd_netlink) > 0)) {
+      emitter_iface_update(params);
+    }
+  }
+
+  close_libnet(&params->libnet);
+  if (params->shm) {
+    ring_shm_close(params->ring);
+  } else {
+    close(params->fd);
+  }
+
+  return NULL;
+}
+
 int main(int argc, char *argv[]) {
   char *config_file = DEFAULT_CONFIG_FILE;
   emitter_params params;
 
+  if (log_start()) {
+    ERROR_COMMENT("Unable to start logging thread\n");
+    exit(-1);
+  }
+  if (daemon_signals()) {
+    exit(-1);
+  }
   NOTICE_PRINT("Verstion : %s (%s)\n",
                EPICS_RELAY_GIT_VERSION, EPICS_RELAY_GIT_REV);
 
@@ -238,52 +370,20 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  memset(&params, 0, sizeof(params));
   if (config_read_emitter(config_file, &params)) {
     ERROR_COMMENT("Unable to read config file\n");
     exit(-1);
   }
 
-  if (bind_socket(params.iface.address, params.port, 0, &params.fd)) {
-    ERROR_COMMENT("Unable to bind to socket\n");
+  if (emitter_setup(&params)) {
     exit(-1);
   }
 
-  // Setup libnet
-  if (setup_libnet(&params.libnet, params.iface_epics_name)) {
-    ERROR_COMMENT("Unable to setup packet emitter\n");
+  if (stats_start(&(params.stats))) {
     exit(-1);
   }
 
-  params.libnet.bcast = params.iface_epics.broadcast;
-
-  struct sockaddr_in client_addr;
-  unsigned int client_addr_len = sizeof(client_addr);
-  unsigned char buffer[2000];
-
-  for (;;) {
-    // Receive client's message:
-    ssize_t rc;
-    if ((rc = recvfrom(params.fd, buffer, sizeof(buffer), 0,
-        (struct sockaddr*)&client_addr, &client_addr_len)) < 0) {
-        ERROR_COMMENT("Could not receive\n");
-    } else {
-      char name[INET_ADDRSTRLEN];
-      if (inet_ntop(AF_INET, &(client_addr.sin_addr), name, sizeof(name))) {
-        DEBUG_PRINT("Received message from IP: %s and port: %i\n", name,
-                    ntohs(client_addr.sin_port));
-      }
-      if (check_udp_packet(&params.iface_epics, buffer, rc)) {
-        ERROR_COMMENT("Packet check failed ... skipping ...\n");
-        continue;
-      }
-
-      if (send_udp_packet(&params.libnet, buffer, rc)) {
-        ERROR_COMMENT("Failed to send packet... exiting\n");
-        exit(-1);
-      }
-    }
-  }
-
-  close_libnet(&params.libnet);
-  close(params.fd);
+  daemon_run(emitter_thread, &params);
 }
+#endif  // EPICS_RELAY_COMBINED
@@ -39,26 +39,42 @@
 #ifndef SRC_EMITTER_H_
 #define SRC_EMITTER_H_
 
-#include <libnet.h>
+#include "ethernet.h"
+#include "broadcast.h"
+#include "compress.h"
+#include "ring.h"
+#include "stats.h"
 
-struct libnet_params {
-  libnet_t *lnet;
-  struct libnet_ether_addr* hw_addr;
-  libnet_ptag_t udp_t;
-  libnet_ptag_t ipv4_t;
-  libnet_ptag_t eth_t;
-  struct in_addr bcast;
-  char errbuf[LIBNET_ERRBUF_SIZE];
-};
+#define EMITTER_POLL_INTERVAL   1   // Interface check with shm (s)
 
 typedef struct {
   int fd;
+  struct stats_socket *sock;
+  char iface_name[128];
   struct ifdatav4 iface;
   struct ifdatav4 iface_epics;
   int port;
+  int mcast;
+  struct sockaddr_in mcast_addr;
   char iface_epics_name[128];
   struct libnet_params libnet;
+  struct compress_peer peers[COMPRESS_MAX_PEERS];
+  unsigned char *buffer;
+  unsigned char *buffer_dict;
+  int shm;
+  char shm_name[128];
+  int shm_slots;
+  struct ring *ring;
+  int fd_netlink;
+  struct stats_config stats;
 } emitter_params;
 
+int check_udp_packet(struct ifdatav4 *iface,
+                     const unsigned char* buffer, ssize_t len);
+int emitter_setup(emitter_params *params);
+void emitter_iface_update(emitter_params *params);
+int emitter_receive(emitter_params *params);
+int emitter_receive_shm(emitter_params *params);
+
 
 #endif  // SRC_EMITTER_H_
@@ -37,13 +37,17 @@
 //
 
 #include <string.h>
+#include <inttypes.h>
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
 #include <arpa/inet.h>
 
 #include "debug.h"
+#include "probes.h"
 #include "ethernet.h"
 #include "epics.h"
+#include "pva.h"
+#include "stats.h"
 
 struct epics_pv_filter_elem* epics_filter_load(const char *filename) {
   FILE * fp;
@@ -116,10 +120,164 @@ struct epics_pv_filter_elem* epics_filter_add(const char *exp) {
     return NULL;
   }
 
+  elem->exp = strdup(exp);
+  if (elem->exp == NULL) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    pcre2_code_free(elem->re);
+    free(elem);
+    return NULL;
+  }
+
   elem->next = NULL;  // This is byt default the last item
   return elem;
 }
 
+void epics_filter_free(struct epics_pv_filter *filter) {
+  struct epics_pv_filter_elem *elem = filter->next;
+  while (elem) {
+    struct epics_pv_filter_elem *next = elem->next;
+    pcre2_code_free(elem->re);
+    free(elem->exp);
+    free(elem);
+    elem = next;
+  }
+  filter->next = NULL;
+}
+
+void epics_filter_set_free(struct epics_filter_set *filters) {
+  if (!filters) {
+    return;
+  }
+
+  epics_filter_free(&(filters->global));
+  if (filters->dest) {
+    for (int i = 0; i < filters->num_dest; i++) {
+      epics_filter_free(&(filters->dest[i]));
+    }
+    free(filters->dest);
+  }
+  free(filters);
+}
+
+// Rule lists are never changed once a filter set is published. An
+// update clones the set, which shares the rules, and changes the clone.
+// Removing a rule copies the part of the list in front of it.
+
+struct epics_filter_set* epics_filter_set_clone(
+  struct epics_filter_set *filters) {
+  struct epics_filter_set *clone = malloc(sizeof(struct epics_filter_set));
+  if (!clone) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return NULL;
+  }
+
+  *clone = *filters;
+  if (filters->num_dest) {
+    clone->dest = malloc(sizeof(struct epics_pv_filter) * filters->num_dest);
+    if (!clone->dest) {
+      ERROR_COMMENT("Unable to allocate memory\n");
+      free(clone);
+      return NULL;
+    }
+    memcpy(clone->dest, filters->dest,
+           sizeof(struct epics_pv_filter) * filters->num_dest);
+  }
+
+  return clone;
+}
+
+void epics_filter_set_release(struct epics_filter_set *filters) {
+  // Free a clone without the rules it shares
+  if (filters) {
+    free(filters->dest);
+    free(filters);
+  }
+}
+
+int epics_filter_insert(struct epics_pv_filter *filter, const char *exp) {
+  struct epics_pv_filter_elem *elem = epics_filter_add(exp);
+  if (elem == NULL) {
+    return -1;
+  }
+
+  elem->next = filter->next;
+  filter->next = elem;
+
+  return 0;
+}
+
+struct epics_pv_filter_elem* epics_filter_remove(
+  struct epics_pv_filter *filter, const char *exp) {
+  struct epics_pv_filter_elem *found = filter->next;
+
+  while (found && strcmp(found->exp, exp)) {
+    found = found->next;
+  }
+
+  if (!found) {
+    return NULL;
+  }
+
+  // Copy the rules in front, they take over the compiled patterns
+  struct epics_pv_filter_elem *head = NULL;
+  struct epics_pv_filter_elem **tail = &head;
+  for (struct epics_pv_filter_elem *elem = filter->next;
+       elem != found; elem = elem->next) {
+    struct epics_pv_filter_elem *copy =
+      malloc(sizeof(struct epics_pv_filter_elem));
+    if (!copy) {
+      ERROR_COMMENT("Unable to allocate memory\n");
+      *tail = NULL;
+      while (head) {
+        struct epics_pv_filter_elem *next = head->next;
+        free(head);
+        head = next;
+      }
+      return NULL;
+    }
+    copy->re = elem->re;
+    copy->exp = elem->exp;
+    *tail = copy;
+    tail = &(copy->next);
+  }
+  *tail = found->next;
+
+  // The old list is returned to be reclaimed after a grace period
+  struct epics_pv_filter_elem *old = filter->next;
+  filter->next = head;
+
+  return old;
+}
+
+void epics_filter_reclaim(struct epics_pv_filter_elem *old,
+                          const char *exp) {
+  // Free the copied rules then the removed one
+  while (old && strcmp(old->exp, exp)) {
+    struct epics_pv_filter_elem *next = old->next;
+    free(old);
+    old = next;
+  }
+
+  if (old) {
+    pcre2_code_free(old->re);
+    free(old->exp);
+    free(old);
+  }
+}
+
+int epics_filter_count(struct epics_filter_set *filters) {
+  int count = 0;
+  for (int i = -1; i < filters->num_dest; i++) {
+    struct epics_pv_filter *filter = (i < 0) ?
+      &(filters->global) : &(filters->dest[i]);
+    for (struct epics_pv_filter_elem *elem = filter->next; elem;
+         elem = elem->next) {
+      count++;
+    }
+  }
+  return count;
+}
+
 int round_up(int num, int factor) {
     return num + factor - 1 - (num + factor - 1) % factor;
 }
@@ -148,47 +306,29 @@ int epics_process_beacon(const char *packet) {
   return sizeof(struct ca_proto_rsrv_is_up);
 }
 
-int epics_process_search(char *dst, const char *src, int *dst_len,
-                         struct epics_pv_filter *filter) {
-  struct ca_proto_search *req =
-    (struct ca_proto_search *)src;
-  int pos = sizeof(struct ca_proto_search);
-
-  DEBUG_PRINT("Reply       : %d\n", htons(req->reply));
-  DEBUG_PRINT("Version     : %d\n", htons(req->version));
-  DEBUG_PRINT("Search ID 1 : %d\n", htonl(req->cid1));
-  DEBUG_PRINT("Search ID 2 : %d\n", htonl(req->cid2));
-
-  int len = htons(req->payload_size);
-
-  char pv[128];
-  if (len >= (int)(sizeof(pv))) {
-    ERROR_PRINT("Payload size of %d is too large (max = %d)\n",
-                len, sizeof(pv));
+int epics_filter_match(struct epics_pv_filter *filter,
+                       const char *pv, int len) {
+  // One match block per thread, only the overall match is needed
+  static _Thread_local pcre2_match_data *match_data = NULL;
 
-    // Exit without processing request
-    *dst_len = 0;
-    pos += len;
-    return pos;
+  if (filter->next == NULL) {
+    DEBUG_COMMENT("No regex matching...\n");
+    return 1;
   }
 
-  // Copy pv to string
-  strncpy(pv, src + pos, len);
-  DEBUG_PRINT("PV Name     : %s\n", pv);
-
-  pos += len;
+  if (match_data == NULL) {
+    match_data = pcre2_match_data_create(1, NULL);
+    if (match_data == NULL) {
+      ERROR_COMMENT("Unable to allocate memory\n");
+      return 0;
+    }
+  }
 
   int match = 0;
-  if (filter->next == NULL) {
-    DEBUG_COMMENT("No regex matching...\n");
-    match = 1;
-  }
 
   // Loop through linked list
   for (struct epics_pv_filter_elem *f = filter->next;
        f != NULL; f = f->next) {
-    pcre2_match_data *match_data =
-      pcre2_match_data_create_from_pattern(f->re, NULL);
     int rc = pcre2_match(
       f->re,                // the compiled pattern
       (PCRE2_SPTR)pv,       // the subject string
@@ -201,53 +341,137 @@ int epics_process_search(char *dst, const char *src, int *dst_len,
     // We use sense as an XOR.
     if (!(rc < 0) != !filter->sense) {
       DEBUG_COMMENT("Match failed\n");
+      match = 0;
       if (filter->logic) {
         // Logical AND. As we failed, quit and
         // set no match
-        match = 0;
         break;
-      } else {
-        match = 0;
       }
     } else {
       DEBUG_COMMENT("Match succeeded\n");
+      match = 1;
       if (!filter->logic) {
         // Logical OR. As we matched,
         // set the match and stop
-        match = 1;
         break;
-      } else {
-        match = 1;
       }
     }
-    pcre2_match_data_free(match_data);
   }
 
-  if (match) {
+  return match;
+}
+
+uint64_t epics_filter_mask(struct epics_filter_set *filters,
+                           const char *pv, int len) {
+  if (!epics_filter_match(&(filters->global), pv, len)) {
+    stats_inc(STATS_FILTER_REJECT);
+    PROBE3(filter, pv, len, 0);
+    return 0;
+  }
+
+  if (!filters->num_dest) {
+    stats_inc(STATS_FILTER_ACCEPT);
+    PROBE3(filter, pv, len, 1);
+    return 1;
+  }
+
+  // Bit i is set if destination i accepts the PV
+  uint64_t mask = 0;
+  for (int i = 0; i < filters->num_dest; i++) {
+    if (epics_filter_match(&(filters->dest[i]), pv, len)) {
+      mask |= (uint64_t)1 << i;
+    }
+  }
+
+  DEBUG_PRINT("Destination mask 0x%" PRIx64 "\n", mask);
+  stats_inc(mask ? STATS_FILTER_ACCEPT : STATS_FILTER_REJECT);
+  PROBE3(filter, pv, len, mask);
+  return mask;
+}
+
+int epics_process_search(const char *src, int len,
+                         struct epics_filter_set *filters,
+                         uint64_t *mask) {
+  struct ca_proto_search *req =
+    (struct ca_proto_search *)src;
+  int pos = sizeof(struct ca_proto_search);
+
+  DEBUG_PRINT("Reply       : %d\n", htons(req->reply));
+  DEBUG_PRINT("Version     : %d\n", htons(req->version));
+  DEBUG_PRINT("Search ID 1 : %d\n", htonl(req->cid1));
+  DEBUG_PRINT("Search ID 2 : %d\n", htonl(req->cid2));
+
+  int size = htons(req->payload_size);
+  *mask = 0;
+
+  if (size > (len - pos)) {
+    ERROR_PRINT("Payload size of %d exceeds packet\n", size);
+    return -1;
+  }
+
+  if (size >= EPICS_PV_MAX_LEN) {
+    ERROR_PRINT("Payload size of %d is too large (max = %d)\n",
+                size, EPICS_PV_MAX_LEN);
+
+    // Exit without processing request
+    return pos + size;
+  }
+
+  // The name is null padded to a multiple of 8
+  const char *pv = src + pos;
+  int pv_len = strnlen(pv, size);
+  DEBUG_PRINT("PV Name     : %.*s\n", pv_len, pv);
+
+  *mask = epics_filter_mask(filters, pv, pv_len);
+  if (*mask) {
     DEBUG_COMMENT("Match include PV\n");
-    *dst_len = pos;
-    memcpy(dst, src, pos);
   } else {
     DEBUG_COMMENT("Match exclude PV\n");
-    *dst_len = 0;
   }
-  DEBUG_PRINT("pos = %d dst_len = %d\n", pos, *dst_len);
-  return pos;
+
+  return pos + size;
 }
 
-int epics_read_packet(char* dest, const char* src, int len,
-                      struct epics_pv_filter *filter) {
+int epics_parse_packet(struct epics_packet *packet, const char* src, int len,
+                       struct epics_filter_set *filters) {
   int pos = 0;
-  int pos_dest = 0;
-  int search = 0;
-  int type = EPICS_TYPE_NONE;
+
+  packet->num_frames = 0;
+  packet->search = 0;
+  packet->mask = 0;
 
   DEBUG_PRINT("Start. Packet len : %d\n", len);
 
   while (pos < len) {
+    if (packet->num_frames == EPICS_MAX_FRAMES) {
+      ERROR_COMMENT("Too many messages in packet\n");
+      break;
+    }
+
+    if ((uint8_t)src[pos] == PVA_MAGIC) {
+      // pvAccess message
+      int _pos = pva_parse_message(packet, src, pos, len, filters);
+      if (_pos < 0) {
+        break;
+      }
+      stats_inc(STATS_FRAME_PVA);
+      PROBE3(frame, -1, pos, _pos);
+      pos += _pos;
+      continue;
+    }
+
+    if ((len - pos) < (int)sizeof(struct ca_proto_msg)) {
+      DEBUG_COMMENT("Truncated message\n");
+      break;
+    }
+
     // Process messages
     struct ca_proto_msg *msg = (struct ca_proto_msg *)
                                (src + pos);
+    struct epics_frame *frame = &(packet->frame[packet->num_frames]);
+    frame->offset = pos;
+    frame->type = EPICS_TYPE_NONE;
+    frame->mask = EPICS_MASK_ALL;
 
     DEBUG_PRINT("Command : %d\n", htons(msg->command));
     DEBUG_PRINT("Payload_size : %d\n", htons(msg->payload_size));
@@ -256,37 +480,64 @@ int epics_read_packet(char* dest, const char* src, int len,
     if (msg->command == CA_PROTO_VERSION) {
       DEBUG_COMMENT("Valid CA_PROTO_VERSION\n");
       _pos = epics_process_version(src + pos);
-      memcpy(dest + pos_dest, src + pos, _pos);
-      pos += _pos;
-      pos_dest += _pos;
     } else if (htons(msg->command) == CA_PROTO_SEARCH) {
       DEBUG_COMMENT("Valid CA_SEARCH_REQUEST\n");
-      type |= EPICS_TYPE_SEARCH;
-      int _pos_dest = 0;
-      _pos = epics_process_search(dest + pos_dest, src + pos, &_pos_dest,
-                                  filter);
-      if (_pos_dest) {
+      frame->type = EPICS_TYPE_SEARCH;
+      _pos = epics_process_search(src + pos, len - pos, filters,
+                                  &(frame->mask));
+      if (_pos < 0) {
+        break;
+      }
+      if (frame->mask) {
         // We accepted the search request
         DEBUG_COMMENT("SEARCH Request accepted\n");
-        search++;
       }
-      pos += _pos;
-      pos_dest += _pos_dest;
+      packet->search++;
+      packet->mask |= frame->mask;
     } else if (htons(msg->command) == CA_PROTO_RSRV_IS_UP) {
       DEBUG_COMMENT("Valid CA_PROTO_RSRV_IS_UP\n");
-      type |= EPICS_TYPE_BEACON;
+      frame->type = EPICS_TYPE_BEACON;
       _pos = epics_process_beacon(src + pos);
-      memcpy(dest + pos_dest, src + pos, _pos);
-      pos += _pos;
-      pos_dest += _pos;
     } else {
       DEBUG_PRINT("Unknown command %d\n", htons(msg->command));
       break;
     }
+
+    stats_cmd(htons(msg->command));
+    PROBE3(frame, htons(msg->command), pos, _pos);
+    frame->len = _pos;
+    pos += _pos;
+    packet->num_frames++;
   }
 
-  if (((type & EPICS_TYPE_SEARCH) == EPICS_TYPE_SEARCH) &&
-      (search == 0)) {
+  return packet->num_frames;
+}
+
+int epics_build_packet(char* dest, const char* src,
+                       struct epics_packet *packet, uint64_t mask) {
+  int pos_dest = 0;
+  int search = 0;
+
+  for (int i = 0; i < packet->num_frames; i++) {
+    struct epics_frame *frame = &(packet->frame[i]);
+    if (frame->type == EPICS_TYPE_PVA_SEARCH) {
+      pos_dest += pva_build_search(dest + pos_dest, src, packet, &i,
+                                   mask, &search);
+      continue;
+    }
+
+    if (!(frame->mask & mask)) {
+      continue;
+    }
+
+    memcpy(dest + pos_dest, src + frame->offset, frame->len);
+    pos_dest += frame->len;
+    if (frame->type == EPICS_TYPE_SEARCH) {
+      search++;
+    }
+  }
+
+  if (packet->search && (search == 0)) {
     DEBUG_COMMENT("Invalid search packet (no valid PVs)\n");
     return 0;
   }
@@ -294,3 +545,71 @@ int epics_read_packet(char* dest, const char* src, int len,
   DEBUG_PRINT("Valid, pos_dest = %d\n", pos_dest);
   return pos_dest;
 }
+
+// Frame writers for clients and load generators, each returns the
+// bytes written or 0 when the frame does not fit in space
+
+int epics_write_version(char *dest, int space) {
+  struct ca_proto_version *msg = (struct ca_proto_version *)dest;
+
+  if ((int)sizeof(*msg) > space) {
+    return 0;
+  }
+
+  memset(msg, 0, sizeof(*msg));
+  msg->command = htons(CA_PROTO_VERSION);
+  msg->version = htons(CA_MINOR_VERSION);
+  return sizeof(*msg);
+}
+
+int epics_write_search(char *dest, int space, const char *name, int len,
+                       uint32_t cid) {
+  struct ca_proto_search *msg = (struct ca_proto_search *)dest;
+  int payload = round_up(len + 1, 8);
+
+  if ((int)sizeof(*msg) + payload > space) {
+    return 0;
+  }
+
+  msg->command = htons(CA_PROTO_SEARCH);
+  msg->payload_size = htons(payload);
+  msg->reply = htons(CA_DONT_REPLY);
+  msg->version = htons(CA_MINOR_VERSION);
+  msg->cid1 = htonl(cid);
+  msg->cid2 = htonl(cid);
+
+  char *pv = dest + sizeof(*msg);
+  memset(pv, 0, payload);
+  memcpy(pv, name, len);
+  return sizeof(*msg) + payload;
+}
+
+int epics_write_beacon(char *dest, int space, uint16_t port, uint32_t id,
+                       uint32_t address) {
+  struct ca_proto_rsrv_is_up *msg = (struct ca_proto_rsrv_is_up *)dest;
+
+  if ((int)sizeof(*msg) > space) {
+    return 0;
+  }
+
+  msg->command = htons(CA_PROTO_RSRV_IS_UP);
+  msg->reserved = 0;
+  msg->version = htons(CA_MINOR_VERSION);
+  msg->port = htons(port);
+  msg->beaconid = htonl(id);
+  msg->address = htonl(address);
+  return sizeof(*msg);
+}
+
+int epics_read_packet(char* dest, const char* src, int len,
+                      struct epics_pv_filter *filter) {
+  struct epics_filter_set filters;
+  struct epics_packet packet;
+
+  filters.global = *filter;
+  filters.num_dest = 0;
+  filters.dest = NULL;
+
+  epics_parse_packet(&packet, src, len, &filters);
+  return epics_build_packet(dest, src, &packet, 1);
+}
@@ -41,14 +41,27 @@
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
 
+#include <stdint.h>
+
+#define EPICS_CA_SERVER_PORT      5064
+#define EPICS_CA_REPEATER_PORT    5065
+#define EPICS_PVA_BROADCAST_PORT  5076
+
 #define EPICS_PV_MAX_LEN      128
+#define EPICS_MAX_FRAMES      512
+#define EPICS_MAX_DEST        64
+#define EPICS_MASK_ALL        (~(uint64_t)0)
 #define CA_PROTO_VERSION      0
 #define CA_PROTO_SEARCH       6
 #define CA_PROTO_RSRV_IS_UP   13
+#define CA_MINOR_VERSION      13
+#define CA_DONT_REPLY         5
 
 #define EPICS_TYPE_NONE       0x00
 #define EPICS_TYPE_SEARCH     0x01
 #define EPICS_TYPE_BEACON     0x02
+#define EPICS_TYPE_PVA_SEARCH 0x04
+#define EPICS_TYPE_PVA_CHANNEL 0x08
 
 struct epics_pv_filter {
   int sense;        // Sense !=0 explicit include
@@ -58,9 +71,30 @@ struct epics_pv_filter {
 
 struct epics_pv_filter_elem {
   pcre2_code *re;
+  char *exp;
   struct epics_pv_filter_elem *next;
 };
 
+struct epics_filter_set {
+  struct epics_pv_filter global;    // Applied to all destinations
+  int num_dest;                     // 0 if no per destination filters
+  struct epics_pv_filter *dest;
+};
+
+struct epics_frame {
+  int offset;
+  int len;
+  int type;
+  uint64_t mask;                    // Destinations accepting the frame
+};
+
+struct epics_packet {
+  int num_frames;
+  int search;                       // Number of search frames
+  uint64_t mask;                    // Destinations accepting any search
+  struct epics_frame frame[EPICS_MAX_FRAMES];
+};
+
 struct ca_proto_msg {
   uint16_t command;
   uint16_t payload_size;
@@ -106,7 +140,31 @@ struct epics_pv {
 
 struct epics_pv_filter_elem* epics_filter_load(const char *filename);
 struct epics_pv_filter_elem* epics_filter_add(const char *exp);
+void epics_filter_free(struct epics_pv_filter *filter);
+void epics_filter_set_free(struct epics_filter_set *filters);
+struct epics_filter_set* epics_filter_set_clone(
+  struct epics_filter_set *filters);
+void epics_filter_set_release(struct epics_filter_set *filters);
+int epics_filter_insert(struct epics_pv_filter *filter, const char *exp);
+struct epics_pv_filter_elem* epics_filter_remove(
+  struct epics_pv_filter *filter, const char *exp);
+void epics_filter_reclaim(struct epics_pv_filter_elem *old,
+                          const char *exp);
+int epics_filter_count(struct epics_filter_set *filters);
+int epics_filter_match(struct epics_pv_filter *filter,
+                       const char *pv, int len);
+uint64_t epics_filter_mask(struct epics_filter_set *filters,
+                           const char *pv, int len);
+int epics_parse_packet(struct epics_packet *packet, const char* src, int len,
+                       struct epics_filter_set *filters);
+int epics_build_packet(char* dest, const char* src,
+                       struct epics_packet *packet, uint64_t mask);
 int epics_read_packet(char* dest, const char* src, int len,
                       struct epics_pv_filter *filter);
+int epics_write_version(char *dest, int space);
+int epics_write_search(char *dest, int space, const char *name, int len,
+                       uint32_t cid);
+int epics_write_beacon(char *dest, int space, uint16_t port, uint32_t id,
+                       uint32_t address);
 
 #endif  // SRC_EPICS_H_
@@ -0,0 +1,66 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef SRC_EPICSRELAY_H_
+#define SRC_EPICSRELAY_H_
+
+// libepicsrelay, the parsing, filtering and relay protocol code used by
+// the collector, emitter and hub, for tools and other programs relaying
+// EPICS traffic. Sockets, rings, statistics and logging are built into
+// the library for the daemons but are not part of its interface.
+//
+//   epics.h / pva.h   CA and pvAccess parsing, filtering, rebuilding and
+//                     writing CA version, search and beacon frames
+//   proto.h           Relay header encode / check and relay packets
+//   compress.h        Search request compression on the relay link
+//   bundle.h          Precompiled filter sets
+//
+// Functions return 0 (or a pointer, or a length) on success and -1 (or
+// NULL, or 0) on failure, after logging the error to stderr.
+//
+// EPICSRELAY_API_VERSION is bumped when a function in these headers
+// changes in a way that breaks existing callers.
+
+#define EPICSRELAY_API_VERSION  1
+
+#include "epics.h"
+#include "pva.h"
+#include "proto.h"
+#include "compress.h"
+#include "bundle.h"
+
+#endif  // SRC_EPICSRELAY_H_
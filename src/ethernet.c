@@ -52,6 +52,9 @@
 #include <netinet/if_ether.h>
 #include <ifaddrs.h>
 #include <netdb.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include "debug.h"
 #include "ethernet.h"
@@ -94,6 +97,18 @@ int bind_socket(struct in_addr ip, uint16_t port, int bcast, int* fd) {
     }
   }
 
+  // Kernel receive time for the latency histograms
+  if (setsockopt(*fd, SOL_SOCKET, SO_TIMESTAMPNS,
+                 &enable, sizeof(enable)) < 0) {
+    ERROR_COMMENT("Unable to set socket option SO_TIMESTAMPNS\n");
+  }
+
+  // Count of datagrams dropped on a full receive queue
+  if (setsockopt(*fd, SOL_SOCKET, SO_RXQ_OVFL,
+                 &enable, sizeof(enable)) < 0) {
+    ERROR_COMMENT("Unable to set socket option SO_RXQ_OVFL\n");
+  }
+
   memset(&si, 0, sizeof(si));
   si.sin_family = AF_INET;
   si.sin_port = htons(port);
@@ -119,6 +134,130 @@ int bind_socket(struct in_addr ip, uint16_t port, int bcast, int* fd) {
   return 0;
 }
 
+ssize_t recv_timestamp(int fd, void *buf, size_t len,
+                       struct sockaddr_in *addr, struct timespec *ts,
+                       uint32_t *drops) {
+  char control[CMSG_SPACE(sizeof(struct timespec)) +
+               CMSG_SPACE(sizeof(uint32_t))];
+  struct iovec iov = {buf, len};
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = addr;
+  msg.msg_namelen = sizeof(struct sockaddr_in);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t rc = recvmsg(fd, &msg, 0);
+  if (rc < 0) {
+    return rc;
+  }
+
+  // A zero time means there is nothing to measure from, the drop
+  // count is only sent once the kernel has dropped something
+  ts->tv_sec = 0;
+  ts->tv_nsec = 0;
+  *drops = 0;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET) {
+      continue;
+    }
+    if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+      memcpy(ts, CMSG_DATA(cmsg), sizeof(struct timespec));
+    } else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+      memcpy(drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+    }
+  }
+
+  return rc;
+}
+
+int set_rcvbuf(int fd, int size) {
+  // Sizes are as the kernel reports them, twice the size set to allow
+  // for its overhead, so the buffer ends up size bytes and not double
+  if (size > 0) {
+    int _size = size / 2;
+    // SO_RCVBUFFORCE goes past rmem_max but needs CAP_NET_ADMIN
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE,
+                   &_size, sizeof(_size)) < 0) {
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &_size, sizeof(_size));
+    }
+  }
+
+  int actual = 0;
+  socklen_t len = sizeof(actual);
+  if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actual, &len) < 0) {
+    return -1;
+  }
+
+  return actual;
+}
+
+int rebind_socket(struct in_addr ip, uint16_t port, int bcast, int* fd) {
+  // Bind the new socket first so the old one keeps working on failure
+  int _fd;
+  if (bind_socket(ip, port, bcast, &_fd)) {
+    if (_fd >= 0) {
+      close(_fd);
+    }
+    return -1;
+  }
+
+  close(*fd);
+  *fd = _fd;
+  return 0;
+}
+
+int multicast_sender(int fd, struct in_addr iface, int ttl) {
+  unsigned char _ttl = ttl;
+  if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL,
+                 &_ttl, sizeof(_ttl)) < 0) {
+    ERROR_COMMENT("Unable to set socket option IP_MULTICAST_TTL\n");
+    return -1;
+  }
+
+  if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF,
+                 &iface, sizeof(iface)) < 0) {
+    ERROR_COMMENT("Unable to set socket option IP_MULTICAST_IF\n");
+    return -1;
+  }
+
+  DEBUG_PRINT("Multicast TTL %d on %s\n", ttl, inet_ntoa(iface));
+  return 0;
+}
+
+int multicast_join(int fd, struct in_addr group, struct in_addr iface) {
+  struct ip_mreq mreq;
+  mreq.imr_multiaddr = group;
+  mreq.imr_interface = iface;
+
+  if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                 &mreq, sizeof(mreq)) < 0) {
+    ERROR_COMMENT("Unable to set socket option IP_ADD_MEMBERSHIP\n");
+    return -1;
+  }
+
+  DEBUG_PRINT("Joined multicast group %s\n", inet_ntoa(group));
+  return 0;
+}
+
+void print_bind_info(int fd) {
+  char ip[16];
+  unsigned int port;
+  struct sockaddr_in addr;
+
+  bzero(&addr, sizeof(addr));
+  socklen_t len = sizeof(addr);
+  getsockname(fd, (struct sockaddr *) &addr, &len);
+  inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+  port = ntohs(addr.sin_port);
+
+  DEBUG_PRINT("Bound to %s:%d\n", ip, port);
+}
+
 int ether_header_size(const u_char *packet) {
   struct ethernet_header *hdr = (struct ethernet_header *)packet;
   if (ntohs(hdr->ether_type) == ETHERTYPE_8021Q) {
@@ -210,3 +349,92 @@ int is_native_packet(struct in_addr *ip, struct ifdatav4 *iface) {
   DEBUG_COMMENT("Native packet\n");
   return 1;
 }
+
+int iface_refresh(const char *device, struct ifdatav4 *iface) {
+  struct ifdatav4 _iface;
+
+  if ((device == NULL) || (device[0] == '\0')) {
+    // Wildcard interfaces never change
+    return 0;
+  }
+
+  memset(&_iface, 0, sizeof(_iface));
+  if (get_interface(device, &_iface)) {
+    return -1;
+  }
+
+  if (_iface.address.s_addr == INADDR_ANY) {
+    // No address at the moment, keep the last one until it is back
+    return 0;
+  }
+
+  if (!memcmp(&_iface, iface, sizeof(_iface))) {
+    return 0;
+  }
+
+  char addr[INET_ADDRSTRLEN], bcast[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &_iface.address, addr, sizeof(addr));
+  inet_ntop(AF_INET, &_iface.broadcast, bcast, sizeof(bcast));
+  NOTICE_PRINT("Interface %s changed to %s broadcast %s\n",
+               device, addr, bcast);
+
+  *iface = _iface;
+  return 1;
+}
+
+int iface_monitor_open(int *fd) {
+  struct sockaddr_nl addr;
+
+  *fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+               NETLINK_ROUTE);
+  if (*fd < 0) {
+    ERROR_COMMENT("Unable to open netlink socket\n");
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+
+  if (bind(*fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    ERROR_COMMENT("Unable to bind netlink socket\n");
+    close(*fd);
+    *fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+int iface_monitor_read(int fd) {
+  char buffer[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+  int changed = 0;
+  int len;
+
+  // Drain everything queued, only whether to refresh is needed
+  while ((len = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    for (struct nlmsghdr *nh = (struct nlmsghdr *)buffer;
+         NLMSG_OK(nh, (unsigned int)len); nh = NLMSG_NEXT(nh, len)) {
+      switch (nh->nlmsg_type) {
+        case RTM_NEWADDR:
+        case RTM_DELADDR:
+        case RTM_NEWLINK:
+        case RTM_DELLINK:
+          changed = 1;
+          break;
+      }
+    }
+  }
+
+  if (len < 0) {
+    if (errno == ENOBUFS) {
+      // Events were lost, refresh anyway
+      changed = 1;
+    } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+      ERROR_COMMENT("Unable to read netlink socket\n");
+      return -1;
+    }
+  }
+
+  return changed;
+}
@@ -41,6 +41,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <net/ethernet.h>
 
@@ -90,8 +91,19 @@ struct ifdatav4 {
 int ether_header_size(const u_char *packet);
 const char * int_to_mac(unsigned char *addr);
 int intmax(int *val, int len);
+void print_bind_info(int fd);
 int bind_socket(struct in_addr ip, uint16_t port, int bcast, int* fd);
+int rebind_socket(struct in_addr ip, uint16_t port, int bcast, int* fd);
+ssize_t recv_timestamp(int fd, void *buf, size_t len,
+                       struct sockaddr_in *addr, struct timespec *ts,
+                       uint32_t *drops);
+int set_rcvbuf(int fd, int size);
+int multicast_sender(int fd, struct in_addr iface, int ttl);
+int multicast_join(int fd, struct in_addr group, struct in_addr iface);
 int get_interface(const char *device, struct ifdatav4 *interface);
 int is_native_packet(struct in_addr *ip, struct ifdatav4 *iface);
+int iface_refresh(const char *device, struct ifdatav4 *iface);
+int iface_monitor_open(int *fd);
+int iface_monitor_read(int fd);
 
 #endif  // SRC_ETHERNET_H_
@@ -0,0 +1,157 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "epics.h"
+#include "bundle.h"
+#include "config.h"
+#include "defs.h"
+
+// Compiles the regex blocks of a collector config into a filter bundle
+// that the collector loads with "bundle" instead of compiling them.
+
+static struct option long_options[] = {
+  {"config", required_argument, 0, 'c'},
+  {"output", required_argument, 0, 'o'},
+  {"test", required_argument, 0, 't'},
+  {0, 0, 0, 0}
+};
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: epics_relay_filterc [-c config] -o bundle\n"
+          "       epics_relay_filterc -t bundle\n");
+}
+
+static double filterc_ms(const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) * 1e3 +
+         (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static int filterc_load(const char *bundle) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct epics_filter_set *filters = bundle_read(bundle, -1);
+  if (!filters) {
+    return -1;
+  }
+
+  printf("Loaded %d rules for %d emitters from %s in %.3f ms\n",
+         epics_filter_count(filters), filters->num_dest, bundle,
+         filterc_ms(&start));
+  epics_filter_set_free(filters);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *config_file = DEFAULT_CONFIG_FILE;
+  const char *output = NULL;
+  const char *test = NULL;
+
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "c:o:t:", long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 'c':
+      config_file = optarg;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 't':
+      test = optarg;
+      break;
+    case '?':
+    default:
+      usage();
+      exit(-1);
+      break;
+    }
+  }
+
+  if ((!output == !test) || (optind != argc)) {
+    usage();
+    exit(-1);
+  }
+
+  if (test) {
+    return filterc_load(test) ? 1 : 0;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int num_dest;
+  struct epics_filter_set *filters = config_read_rules(config_file,
+                                                       &num_dest);
+  if (!filters) {
+    ERROR_PRINT("Unable to read rules from %s\n", config_file);
+    exit(-1);
+  }
+
+  printf("Compiled %d rules for %d emitters from %s in %.3f ms\n",
+         epics_filter_count(filters), filters->num_dest, config_file,
+         filterc_ms(&start));
+
+  if (bundle_write(output, filters)) {
+    epics_filter_set_free(filters);
+    exit(-1);
+  }
+  epics_filter_set_free(filters);
+
+  struct stat st;
+  if (!stat(output, &st)) {
+    printf("Wrote %s, %ld bytes\n", output, (long)st.st_size);
+  }
+
+  // Check the bundle loads with this PCRE2
+  return filterc_load(output) ? 1 : 0;
+}
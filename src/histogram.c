@@ -0,0 +1,89 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+uint64_t histogram_value(int bucket) {
+  // Midpoint of the values falling into the bucket
+  if (bucket < HISTOGRAM_SUB_COUNT) {
+    return bucket;
+  }
+
+  int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+  uint64_t low = (uint64_t)(HISTOGRAM_SUB_COUNT +
+                            (bucket & (HISTOGRAM_SUB_COUNT - 1))) << shift;
+  return low + (((uint64_t)1 << shift) >> 1);
+}
+
+uint64_t histogram_percentile(const struct histogram *hist, double p) {
+  uint64_t total = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    total += hist->bucket[i];
+  }
+  if (!total) {
+    return 0;
+  }
+
+  // Rank of the value below which p percent of the values fall
+  uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+
+  uint64_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += hist->bucket[i];
+    if (seen >= rank) {
+      return histogram_value(i);
+    }
+  }
+
+  return histogram_max(hist);
+}
+
+uint64_t histogram_max(const struct histogram *hist) {
+  for (int i = HISTOGRAM_BUCKETS - 1; i >= 0; i--) {
+    if (hist->bucket[i]) {
+      return histogram_value(i);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef SRC_HISTOGRAM_H_
+#define SRC_HISTOGRAM_H_
+
+#include <stdint.h>
+
+// Log-linear histogram of nanosecond values. Every power of two is
+// split into 2^HISTOGRAM_SUB_BITS linear buckets, so a value is known
+// to within 1/16 (6%) of itself from 1 ns up to 2^HISTOGRAM_MAX_BITS ns
+// (about 68 s). Larger values land in the last bucket.
+
+#define HISTOGRAM_SUB_BITS    4
+#define HISTOGRAM_SUB_COUNT   (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS    36
+#define HISTOGRAM_BUCKETS     \
+  ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+struct histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t bucket[HISTOGRAM_BUCKETS];
+};
+
+static inline int histogram_bucket(uint64_t value) {
+  if (value < HISTOGRAM_SUB_COUNT) {
+    return value;
+  }
+  if (value >> HISTOGRAM_MAX_BITS) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+
+  // Top bit selects the power of two, the next bits the linear bucket
+  int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) +
+    (int)(value >> shift) - HISTOGRAM_SUB_COUNT;
+}
+
+static inline void histogram_record(struct histogram *hist, uint64_t value) {
+  // Only the owning thread writes, the stores just have to be untorn
+  uint64_t *bucket = &(hist->bucket[histogram_bucket(value)]);
+  __atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&(hist->sum), hist->sum + value, __ATOMIC_RELAXED);
+  __atomic_store_n(&(hist->count), hist->count + 1, __ATOMIC_RELAXED);
+}
+
+uint64_t histogram_value(int bucket);
+uint64_t histogram_percentile(const struct histogram *hist, double p);
+uint64_t histogram_max(const struct histogram *hist);
+
+#endif  // SRC_HISTOGRAM_H_
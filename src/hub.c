@@ -0,0 +1,326 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ethernet.h"
+#include "debug.h"
+#include "probes.h"
+#include "proto.h"
+#include "epics.h"
+#include "broadcast.h"
+#include "hub.h"
+#include "defs.h"
+#include "config.h"
+#include "stats.h"
+#include "daemon.h"
+
+extern const char* EPICS_RELAY_GIT_REV;
+extern const char* EPICS_RELAY_GIT_BRANCH;
+extern const char* EPICS_RELAY_GIT_VERSION;
+
+static struct option long_options[] = {
+  {"debug", no_argument, &debug_flag, -1},
+  {"config", required_argument, 0, 'c'},
+  {0, 0, 0, 0}
+};
+
+int hub_setup(hub_params *params) {
+  params->listen_ports[0] = EPICS_CA_SERVER_PORT;
+  params->listen_ports[1] = EPICS_CA_REPEATER_PORT;
+  params->listen_ports[2] = EPICS_PVA_BROADCAST_PORT;
+
+  for (int i = 0; i < params->num_iface; i++) {
+    struct hub_iface *iface = &(params->iface[i]);
+
+    for (int j = 0; j < HUB_NUM_PORTS; j++) {
+      DEBUG_PRINT("Setting up %s port %d\n", iface->name,
+                  params->listen_ports[j]);
+      if (bind_socket(iface->iface.broadcast, params->listen_ports[j],
+                      1, &(iface->fd_listen[j]))) {
+        return -1;
+      }
+      print_bind_info(iface->fd_listen[j]);
+
+      char name[160];
+      snprintf(name, sizeof(name), "%s:%d", iface->name,
+               params->listen_ports[j]);
+      iface->sock_listen[j] = stats_socket(name, &(params->stats));
+      stats_socket_open(iface->sock_listen[j], iface->fd_listen[j]);
+    }
+
+    if (setup_libnet(&(iface->libnet), iface->name)) {
+      ERROR_PRINT("Unable to setup packet emitter on %s\n", iface->name);
+      return -1;
+    }
+    iface->libnet.bcast = iface->iface.broadcast;
+  }
+
+  // Follow address changes, relaying works without it
+  if (iface_monitor_open(&(params->fd_netlink))) {
+    ERROR_COMMENT("Interface changes will not be tracked\n");
+  }
+
+  return 0;
+}
+
+void hub_iface_update(hub_params *params) {
+  for (int i = 0; i < params->num_iface; i++) {
+    struct hub_iface *iface = &(params->iface[i]);
+    struct in_addr broadcast = iface->iface.broadcast;
+
+    if (iface_refresh(iface->name, &(iface->iface)) <= 0) {
+      continue;
+    }
+
+    if (broadcast.s_addr != iface->iface.broadcast.s_addr) {
+      for (int j = 0; j < HUB_NUM_PORTS; j++) {
+        if (rebind_socket(iface->iface.broadcast, params->listen_ports[j],
+                          1, &(iface->fd_listen[j]))) {
+          ERROR_PRINT("Unable to rebind %s port %d\n", iface->name,
+                      params->listen_ports[j]);
+          continue;
+        }
+        stats_socket_open(iface->sock_listen[j], iface->fd_listen[j]);
+      }
+    }
+
+    // The device may have been recreated, so start libnet again
+    close_libnet(&(iface->libnet));
+    if (setup_libnet(&(iface->libnet), iface->name)) {
+      ERROR_PRINT("Unable to setup packet emitter on %s\n", iface->name);
+    }
+    iface->libnet.bcast = iface->iface.broadcast;
+  }
+}
+
+void hub_receive(hub_params *params, int src, int port,
+                 char *data_src, char *data_dst,
+                 struct epics_packet *packet) {
+  struct hub_iface *iface = &(params->iface[src]);
+  struct proto_udp_header *header = (struct proto_udp_header*)data_dst;
+  struct sockaddr_in si;
+  struct timespec ts;
+  uint32_t drops;
+
+  int len = recv_timestamp(iface->fd_listen[port], data_src, PROTO_BUF_SIZE,
+                           &si, &ts, &drops);
+
+  DEBUG_PRINT("Recieve %s: %s:%d %d bytes\n", iface->name,
+              inet_ntoa(si.sin_addr), ntohs(si.sin_port), len);
+
+  if (len <= 0) {
+    return;
+  }
+  stats_inc(STATS_RX_CA_SERVER + port);
+  PROBE3(receive, params->listen_ports[port], len, si.sin_addr.s_addr);
+  stats_drops(iface->sock_listen[port], iface->fd_listen[port], drops, &ts);
+
+  // This also drops the packets we broadcast onto this subnet
+  if (!is_native_packet(&(si.sin_addr), &(iface->iface))) {
+    DEBUG_COMMENT("Non native packet ... skipping ...\n");
+    return;
+  }
+
+  // Parse once for all routes from this interface
+  if (!epics_parse_packet(packet, data_src, len, &(iface->filter))) {
+    DEBUG_COMMENT("No valid packet....\n");
+    return;
+  }
+  stats_latency(STATS_LATENCY_PARSE, &ts);
+
+  header->src_ip = si.sin_addr.s_addr;
+  header->src_port = si.sin_port;
+  header->dst_port = htons(params->listen_ports[port]);
+
+  int shared = !iface->filter.num_dest;
+  int _len = 0;
+  int built = 0;
+
+  for (int i = 0; i < params->num_iface; i++) {
+    uint64_t bit = (uint64_t)1 << i;
+    if (!(iface->routes & bit)) {
+      continue;
+    }
+
+    if (!shared || !built) {
+      _len = epics_build_packet(data_dst + sizeof(struct proto_udp_header),
+                                data_src, packet, shared ? 1 : bit);
+      built = 1;
+    }
+
+    if (!_len) {
+      continue;
+    }
+
+    struct hub_iface *dest = &(params->iface[i]);
+    header->dst_ip = dest->iface.broadcast.s_addr;
+    header->payload_len = _len;
+
+    if (send_udp_packet(&(dest->libnet), (unsigned char *)data_dst,
+                        _len + sizeof(struct proto_udp_header))) {
+      ERROR_PRINT("Unable to send to %s\n", dest->name);
+      stats_send(i, 0);
+      continue;
+    }
+    stats_send(i, 1);
+    stats_latency(STATS_LATENCY_BCAST, &ts);
+
+    DEBUG_PRINT("Relayed %d bytes from %s to %s\n", _len,
+                iface->name, dest->name);
+  }
+}
+
+void hub_start(hub_params *params) {
+  fd_set socks;
+
+  // Allocate data buffer
+  char data_src[PROTO_BUF_SIZE];
+  char data_dst[PROTO_BUF_SIZE];
+  struct epics_packet packet;
+
+  // Set header struct
+  proto_header_init((struct proto_udp_header*)data_dst);
+
+  // Loop forever!
+  while (1) {
+    // Sockets change when an interface is rebound
+    int maxfd = params->fd_netlink;
+    FD_ZERO(&socks);
+    for (int i = 0; i < params->num_iface; i++) {
+      for (int j = 0; j < HUB_NUM_PORTS; j++) {
+        FD_SET(params->iface[i].fd_listen[j], &socks);
+      }
+      int _maxfd = intmax(params->iface[i].fd_listen, HUB_NUM_PORTS);
+      if (_maxfd > maxfd) {
+        maxfd = _maxfd;
+      }
+    }
+    if (params->fd_netlink >= 0) {
+      FD_SET(params->fd_netlink, &socks);
+    }
+
+    if (select(maxfd + 1, &socks, NULL, NULL, NULL) < 0) {
+      ERROR_COMMENT("Select failed\n");
+      continue;
+    }
+
+    // Interface changes are applied between packets
+    if ((params->fd_netlink >= 0) && FD_ISSET(params->fd_netlink, &socks) &&
+        (iface_monitor_read(params->fd_netlink) > 0)) {
+      hub_iface_update(params);
+      continue;
+    }
+
+    for (int i = 0; i < params->num_iface; i++) {
+      for (int j = 0; j < HUB_NUM_PORTS; j++) {
+        if (FD_ISSET(params->iface[i].fd_listen[j], &socks)) {
+          hub_receive(params, i, j, data_src, data_dst, &packet);
+        }
+      }
+    }
+  }
+}
+
+static void* hub_thread(void *arg) {
+  hub_start(arg);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  hub_params params;
+  char *config_file = DEFAULT_CONFIG_FILE;
+
+  if (log_start()) {
+    ERROR_COMMENT("Unable to start logging thread\n");
+    exit(-1);
+  }
+  if (daemon_signals()) {
+    exit(-1);
+  }
+  NOTICE_PRINT("Verstion : %s (%s)\n",
+               EPICS_RELAY_GIT_VERSION, EPICS_RELAY_GIT_REV);
+
+  // Parse command line options
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "dc:",
+                        long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 0:
+      break;
+    case 'd':
+      debug_flag = -1;
+      break;
+    case 'c':
+      config_file = optarg;
+      break;
+    case '?':
+    default:
+      exit(-1);
+      break;
+    }
+  }
+
+  if (config_read_hub(config_file, &params)) {
+    ERROR_COMMENT("Unable to process config file\n");
+    exit(-1);
+  }
+
+  if (hub_setup(&params)) {
+    ERROR_COMMENT("Unable to setup interfaces\n");
+    exit(-1);
+  }
+
+  if (stats_start(&(params.stats))) {
+    exit(-1);
+  }
+
+  daemon_run(hub_thread, &params);
+}
@@ -0,0 +1,277 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "debug.h"
+#include "log.h"
+
+#define LOG_INTERVAL          1     // Writer wakes up to report, seconds
+
+// Set by the programs from their --debug option
+int debug_flag = 0;
+
+struct log_slot {
+  uint32_t seq;               // Slot is free when seq equals the position
+  int len;
+  char text[LOG_RECORD_SIZE];
+};
+
+// Bounded multi producer ring, each slot carries a sequence number so
+// producers claim slots with one CAS and the writer knows when a slot
+// is complete.
+static struct log_slot log_ring[LOG_SLOTS];
+static uint32_t log_head __attribute__((aligned(64))) = 0;
+static uint32_t log_tail __attribute__((aligned(64))) = 0;
+static uint32_t log_pending __attribute__((aligned(64))) = 0;
+static uint32_t log_waiting = 0;
+static uint32_t log_lost = 0;
+static int log_running = 0;
+
+// Sites which had messages suppressed
+static struct log_site *log_sites = NULL;
+
+// Held while writing, and by the one thread emptying the ring
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int log_futex(uint32_t *addr, int op, uint32_t val,
+                     const struct timespec *timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static int64_t log_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return now.tv_sec;
+}
+
+static int log_rate(struct log_site *site) {
+  int64_t now = log_now();
+
+  // A new second starts a new burst, racing threads only blur the count
+  if (__atomic_load_n(&site->window, __ATOMIC_RELAXED) != now) {
+    __atomic_store_n(&site->window, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+  }
+
+  if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) <
+      (uint32_t)site->limit) {
+    return 1;
+  }
+
+  __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+  if (!__atomic_exchange_n(&site->listed, 1, __ATOMIC_ACQ_REL)) {
+    site->next = __atomic_load_n(&log_sites, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&log_sites, &(site->next), site, 0,
+                                        __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+  }
+
+  return 0;
+}
+
+static int log_push(const char *text, int len) {
+  uint32_t pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+  struct log_slot *slot;
+
+  for (;;) {
+    slot = &(log_ring[pos & (LOG_SLOTS - 1)]);
+    int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) -
+                             pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Full, never block the caller
+      return -1;
+    } else {
+      pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    }
+  }
+
+  memcpy(slot->text, text, len);
+  slot->len = len;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+  __atomic_fetch_add(&log_pending, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&log_waiting, __ATOMIC_SEQ_CST)) {
+    log_futex(&log_pending, FUTEX_WAKE, INT_MAX, NULL);
+  }
+
+  return 0;
+}
+
+void log_print(struct log_site *site, const char *fmt, ...) {
+  char text[LOG_RECORD_SIZE];
+  va_list args;
+
+  if (site->limit && !log_rate(site)) {
+    return;
+  }
+
+  va_start(args, fmt);
+  int len = vsnprintf(text, sizeof(text), fmt, args);
+  va_end(args);
+  if (len < 0) {
+    return;
+  }
+  if (len >= (int)sizeof(text)) {
+    // Keep the line ending of a truncated message
+    len = sizeof(text) - 1;
+    text[len - 1] = '\n';
+  }
+
+  if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&log_lock);
+    fwrite(text, 1, len, stderr);
+    pthread_mutex_unlock(&log_lock);
+    return;
+  }
+
+  if (log_push(text, len)) {
+    __atomic_fetch_add(&log_lost, 1, __ATOMIC_RELAXED);
+  }
+}
+
+static void log_drain(void) {
+  for (;;) {
+    struct log_slot *slot = &(log_ring[log_tail & (LOG_SLOTS - 1)]);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log_tail + 1) {
+      break;
+    }
+    fwrite(slot->text, 1, slot->len, stderr);
+    __atomic_store_n(&slot->seq, log_tail + LOG_SLOTS, __ATOMIC_RELEASE);
+    log_tail++;
+  }
+}
+
+static void log_report(void) {
+  int64_t now = log_now();
+
+  for (struct log_site *site = __atomic_load_n(&log_sites, __ATOMIC_ACQUIRE);
+       site; site = site->next) {
+    // Wait for the burst to end to report it in one line
+    if (__atomic_load_n(&site->window, __ATOMIC_RELAXED) == now) {
+      continue;
+    }
+    uint32_t num = __atomic_exchange_n(&site->suppressed, 0,
+                                       __ATOMIC_RELAXED);
+    if (num) {
+      fprintf(stderr, SD_WARNING " %s:%d: %u messages suppressed\n",
+              site->file, site->line, num);
+    }
+  }
+
+  uint32_t lost = __atomic_exchange_n(&log_lost, 0, __ATOMIC_RELAXED);
+  if (lost) {
+    fprintf(stderr, SD_WARNING " %u messages lost, log full\n", lost);
+  }
+}
+
+void log_flush(void) {
+  pthread_mutex_lock(&log_lock);
+  log_drain();
+  log_report();
+  fflush(stderr);
+  pthread_mutex_unlock(&log_lock);
+}
+
+static void* log_thread(void *arg) {
+  (void)arg;
+  struct timespec timeout = {LOG_INTERVAL, 0};
+
+  for (;;) {
+    uint32_t pending = __atomic_load_n(&log_pending, __ATOMIC_SEQ_CST);
+    log_flush();
+
+    // Say we are waiting then check again so a push is never missed
+    __atomic_store_n(&log_waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&log_pending, __ATOMIC_SEQ_CST) == pending) {
+      log_futex(&log_pending, FUTEX_WAIT, pending, &timeout);
+    }
+    __atomic_store_n(&log_waiting, 0, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+int log_start(void) {
+  pthread_t thread;
+  sigset_t mask, old;
+  int rtn;
+
+  for (int i = 0; i < LOG_SLOTS; i++) {
+    log_ring[i].seq = i;
+  }
+
+  // The writer inherits a mask with every asynchronous signal blocked so
+  // SIGHUP and friends only reach the threads that wait for them
+  sigfillset(&mask);
+  sigdelset(&mask, SIGSEGV);
+  sigdelset(&mask, SIGBUS);
+  sigdelset(&mask, SIGFPE);
+  sigdelset(&mask, SIGILL);
+  if (pthread_sigmask(SIG_BLOCK, &mask, &old)) {
+    return -1;
+  }
+  rtn = pthread_create(&thread, NULL, log_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (rtn) {
+    return -1;
+  }
+  pthread_detach(thread);
+
+  // Messages still in the ring are written out on exit
+  atexit(log_flush);
+  __atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
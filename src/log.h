@@ -0,0 +1,69 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef SRC_LOG_H_
+#define SRC_LOG_H_
+
+#include <stdint.h>
+
+#define LOG_SLOTS             512   // Records in the ring, power of 2
+#define LOG_RECORD_SIZE       256   // Longer messages are truncated
+#define LOG_BURST             10    // Messages per call site per second
+
+// Messages are formatted by the caller into fixed size records and
+// pushed onto a lock-free ring, a background thread writes them out.
+// Each call site may log LOG_BURST messages a second, the rest are
+// counted and reported as suppressed by the writer thread.
+
+struct log_site {
+  const char *file;
+  int line;
+  int limit;                  // 0 for no rate limit
+  int64_t window;             // Second the count is for
+  uint32_t count;
+  uint32_t suppressed;
+  int listed;                 // Linked into the suppressed list
+  struct log_site *next;
+};
+
+void log_print(struct log_site *site, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+void log_flush(void);
+int log_start(void);
+
+#endif  // SRC_LOG_H_
@@ -0,0 +1,564 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#define _GNU_SOURCE     /* To get sendmmsg */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/futex.h>
+
+#include "debug.h"
+#include "probes.h"
+#include "proto.h"
+#include "ethernet.h"
+#include "compress.h"
+#include "pipeline.h"
+
+#define PIPELINE_RX_SIZE  (sizeof(struct pipeline_rx) + PROTO_BUF_SIZE)
+#define PIPELINE_TX_SIZE  (sizeof(struct pipeline_tx) + PROTO_BUF_SIZE)
+
+// Packets taken from the workers for one batch. Each emitter socket
+// has its own list of messages, all pointing into the entries.
+struct pipeline_send {
+  char *entry;                      // Copies of struct pipeline_tx
+  char *cmp;                        // Compressed packet of each entry
+  int *sent;                        // Entry reached at least one emitter
+  struct mmsghdr *msg;              // batch messages per emitter
+  struct iovec *iov;
+  int *msg_entry;                   // Entry sent by each message
+  int *count;                       // Messages per emitter
+  struct sockaddr_in *addr;         // Emitter addresses for the batch
+};
+
+static int pipeline_futex(uint32_t *addr, int op, uint32_t val,
+                          const struct timespec *timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static void pipeline_wake(struct pipeline *pipeline) {
+  __atomic_add_fetch(&(pipeline->doorbell), 1, __ATOMIC_SEQ_CST);
+  pipeline_futex(&(pipeline->doorbell), FUTEX_WAKE_PRIVATE, 1, NULL);
+}
+
+static void pipeline_notify(struct pipeline *pipeline) {
+  // Only ring when the sender has said it is asleep, as ring_commit()
+  if (__atomic_load_n(&(pipeline->sleeping), __ATOMIC_SEQ_CST)) {
+    pipeline_wake(pipeline);
+  }
+}
+
+static int pipeline_pending(struct pipeline *pipeline) {
+  if (__atomic_load_n(&(pipeline->iface_update), __ATOMIC_SEQ_CST)) {
+    return 1;
+  }
+
+  for (int i = 0; i < pipeline->num_workers; i++) {
+    if (ring_depth(pipeline->worker[i].out)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void pipeline_sleep(struct pipeline *pipeline) {
+  struct timespec timeout = {1, 0};
+  uint32_t bell = __atomic_load_n(&(pipeline->doorbell), __ATOMIC_SEQ_CST);
+
+  // Say we are sleeping then check again so a packet is never missed
+  __atomic_store_n(&(pipeline->sleeping), 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!pipeline_pending(pipeline)) {
+    pipeline_futex(&(pipeline->doorbell), FUTEX_WAIT_PRIVATE, bell,
+                   &timeout);
+  }
+  __atomic_store_n(&(pipeline->sleeping), 0, __ATOMIC_RELAXED);
+}
+
+static void pipeline_receive(collector_params *params, int n) {
+  struct pipeline *pipeline = params->pipeline;
+  struct pipeline_worker *worker = NULL;
+  struct pipeline_rx *rx = NULL;
+  struct sockaddr_in si;
+  struct timespec ts;
+  uint32_t drops;
+  int first = pipeline->next;
+
+  // Round robin, passing over workers which are full
+  for (int i = 0; i < pipeline->num_workers; i++) {
+    struct pipeline_worker *_worker = &(pipeline->worker[pipeline->next]);
+    pipeline->next = (pipeline->next + 1) % pipeline->num_workers;
+    if (ring_depth(_worker->in) < _worker->in->num_slots) {
+      worker = _worker;
+      rx = ring_reserve(worker->in);
+      break;
+    }
+  }
+
+  // The socket is drained even when there is nowhere to put the packet
+  char *data = rx ? rx->data : pipeline->scratch;
+  int len = recv_timestamp(params->fd_listen[n], data, PROTO_BUF_SIZE,
+                           &si, &ts, &drops);
+
+  DEBUG_PRINT("Recieve %d: %s:%d %d bytes\n", n,
+              inet_ntoa(si.sin_addr), ntohs(si.sin_port), len);
+
+  if (len <= 0) {
+    return;
+  }
+  stats_inc(STATS_RX_CA_SERVER + n);
+  PROBE3(receive, params->listen_ports[n], len, si.sin_addr.s_addr);
+  stats_drops(params->sock_listen[n], params->fd_listen[n], drops, &ts);
+
+  if (!rx) {
+    // Counted against the worker whose turn it was
+    struct ring *ring = pipeline->worker[first].in;
+    __atomic_fetch_add(&(ring->dropped), 1, __ATOMIC_RELAXED);
+    DEBUG_COMMENT("Pipeline full ... dropping ...\n");
+    return;
+  }
+
+  if (!is_native_packet(&(si.sin_addr), &(params->iface_listen))) {
+    DEBUG_COMMENT("Non native packet ... skipping ...\n");
+    return;
+  }
+
+  rx->ts = ts;
+  rx->src_ip = si.sin_addr.s_addr;
+  rx->src_port = si.sin_port;
+  rx->dst_ip = params->iface_listen.broadcast.s_addr;
+  rx->port = n;
+  rx->len = len;
+  ring_commit(worker->in, sizeof(struct pipeline_rx) + len);
+}
+
+static void pipeline_filter_packet(struct pipeline_worker *worker,
+                                   const struct pipeline_rx *rx) {
+  collector_params *params = worker->params;
+  struct epics_packet *packet = &(worker->packet);
+
+  rcu_read_lock(&(params->rcu[worker->n]));
+  struct epics_filter_set *filter = __atomic_load_n(&(params->filter),
+                                                    __ATOMIC_ACQUIRE);
+
+  int num_frames = epics_parse_packet(packet, rx->data, rx->len, filter);
+
+  // Without per emitter filters all emitters get the same packet
+  int shared = !filter->num_dest;
+  rcu_read_unlock(&(params->rcu[worker->n]));
+
+  if (!num_frames) {
+    DEBUG_COMMENT("No valid packet....\n");
+    return;
+  }
+  stats_latency(STATS_LATENCY_PARSE, &(rx->ts));
+
+  // Packets are built here, compression is left to the sender which
+  // owns the dictionaries
+  for (int i = 0; i < (shared ? 1 : params->num_fd); i++) {
+    struct pipeline_tx *tx = ring_reserve(worker->out);
+    if (!tx) {
+      DEBUG_COMMENT("Send ring full ... dropping ...\n");
+      return;
+    }
+
+    struct proto_udp_header *header = (struct proto_udp_header*)tx->data;
+    proto_header_init(header);
+    header->src_ip = rx->src_ip;
+    header->src_port = rx->src_port;
+    header->dst_port = htons(params->listen_ports[rx->port]);
+    header->dst_ip = rx->dst_ip;
+
+    char *data_out;
+    uint64_t mask = shared ? 1 : ((uint64_t)1 << i);
+    int len = proto_build_packet(packet, rx->data, mask, NULL,
+                                 tx->data, NULL, &data_out);
+    if (!len) {
+      continue;
+    }
+
+    tx->ts = rx->ts;
+    tx->dest = shared ? -1 : i;
+    tx->len = len + sizeof(struct proto_udp_header);
+    ring_commit(worker->out, sizeof(struct pipeline_tx) + tx->len);
+    pipeline_notify(params->pipeline);
+  }
+}
+
+static void* pipeline_filter(void *arg) {
+  struct pipeline_worker *worker = arg;
+  struct timespec timeout = {1, 0};
+  struct timespec start;
+  const struct pipeline_rx *rx;
+  uint32_t len;
+
+  for (;;) {
+    if (ring_wait(worker->in, &timeout)) {
+      continue;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((rx = ring_peek(worker->in, &len))) {
+      pipeline_filter_packet(worker, rx);
+      ring_release(worker->in);
+    }
+    stats_busy(worker->stats, &start);
+  }
+
+  return NULL;
+}
+
+static struct pipeline_tx* pipeline_entry(struct pipeline_send *send,
+                                          int k) {
+  return (struct pipeline_tx*)(send->entry + (size_t)k * PIPELINE_TX_SIZE);
+}
+
+static char* pipeline_compress(collector_params *params,
+                               struct pipeline_send *send, int k,
+                               int *len) {
+  struct pipeline_tx *tx = pipeline_entry(send, k);
+  struct compress_dict *dict = params->dict[(tx->dest < 0) ? 0 : tx->dest];
+  char *cmp = send->cmp + (size_t)k * PROTO_BUF_SIZE;
+  uint32_t epoch;
+
+  int _len = compress_encode(dict, &epoch,
+                             cmp + sizeof(struct proto_udp_header),
+                             PROTO_BUF_SIZE -
+                             sizeof(struct proto_udp_header),
+                             tx->data + sizeof(struct proto_udp_header),
+                             tx->len - sizeof(struct proto_udp_header));
+  if (!_len) {
+    *len = tx->len;
+    return tx->data;
+  }
+
+  memcpy(cmp, tx->data, sizeof(struct proto_udp_header));
+  struct proto_udp_header *header = (struct proto_udp_header*)cmp;
+  header->type = PROTO_TYPE_DICT;
+  header->dict_epoch = epoch;
+  header->payload_len = _len;
+  *len = _len + sizeof(struct proto_udp_header);
+  return cmp;
+}
+
+static void pipeline_flush(collector_params *params, int num) {
+  struct pipeline *pipeline = params->pipeline;
+  struct pipeline_send *send = pipeline->send;
+  int batch = pipeline->batch;
+  int local = params->shm ? (params->num_fd - 1) : -1;
+
+  for (int i = 0; i < params->num_fd; i++) {
+    // The resolver may change the address at any time
+    send->count[i] = 0;
+    send->addr[i] = params->emitter_addr[i];
+    send->addr[i].sin_addr.s_addr = __atomic_load_n(
+      &(params->emitter_addr[i].sin_addr.s_addr), __ATOMIC_RELAXED);
+  }
+
+  // Sort the packets into a list of messages for each emitter
+  for (int k = 0; k < num; k++) {
+    struct pipeline_tx *tx = pipeline_entry(send, k);
+    int first = (tx->dest < 0) ? 0 : tx->dest;
+    int last = (tx->dest < 0) ? (params->num_fd - 1) : tx->dest;
+    char *data_out = tx->data;
+    int len = tx->len;
+
+    // One compressed packet serves all the emitters over the network
+    send->sent[k] = 0;
+    if (params->dict && ((first != local) || (last != local))) {
+      data_out = pipeline_compress(params, send, k, &len);
+    }
+
+    for (int i = first; i <= last; i++) {
+      if (i == local) {
+        // The local emitter takes the uncompressed packet
+        void *slot = ring_reserve(params->ring);
+        stats_send(i, slot != NULL);
+        PROBE3(send, i, slot ? tx->len : -1, 0);
+        if (!slot) {
+          DEBUG_COMMENT("Shared memory ring full ... dropping ...\n");
+          continue;
+        }
+        memcpy(slot, tx->data, tx->len);
+        ring_commit(params->ring, tx->len);
+        send->sent[k] = 1;
+        continue;
+      }
+
+      if (send->addr[i].sin_addr.s_addr == INADDR_ANY) {
+        DEBUG_PRINT("Emitter %d not resolved ... skipping ...\n", i);
+        continue;
+      }
+
+      int m = i * batch + send->count[i]++;
+      send->iov[m].iov_base = data_out;
+      send->iov[m].iov_len = len;
+      memset(&(send->msg[m]), 0, sizeof(struct mmsghdr));
+      send->msg[m].msg_hdr.msg_name = &(send->addr[i]);
+      send->msg[m].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      send->msg[m].msg_hdr.msg_iov = &(send->iov[m]);
+      send->msg[m].msg_hdr.msg_iovlen = 1;
+      send->msg_entry[m] = k;
+    }
+  }
+
+  // One system call per emitter for the whole batch
+  for (int i = 0; i < params->num_fd; i++) {
+    struct mmsghdr *msg = &(send->msg[i * batch]);
+    int *msg_entry = &(send->msg_entry[i * batch]);
+    int count = send->count[i];
+    int done = 0;
+
+    while (done < count) {
+      int sent = sendmmsg(params->fd[i], msg + done, count - done, 0);
+      if (sent <= 0) {
+        // Skip the message which failed and carry on with the rest
+        ERROR_COMMENT("Unable to send....\n");
+        stats_send(i, 0);
+        PROBE3(send, i, -1, send->addr[i].sin_addr.s_addr);
+        done++;
+        continue;
+      }
+
+      for (int j = done; j < done + sent; j++) {
+        stats_send(i, 1);
+        PROBE3(send, i, (int)msg[j].msg_len, send->addr[i].sin_addr.s_addr);
+        send->sent[msg_entry[j]] = 1;
+      }
+      done += sent;
+    }
+  }
+
+  for (int k = 0; k < num; k++) {
+    if (send->sent[k]) {
+      stats_latency(STATS_LATENCY_SEND, &(pipeline_entry(send, k)->ts));
+    }
+  }
+}
+
+static void* pipeline_send(void *arg) {
+  collector_params *params = arg;
+  struct pipeline *pipeline = params->pipeline;
+  struct timespec start;
+  int w = 0;
+
+  for (;;) {
+    // Relay sockets are only used here, so are updated here
+    if (__atomic_exchange_n(&(pipeline->iface_update), 0,
+                            __ATOMIC_ACQ_REL)) {
+      collector_iface_update_relay(params);
+    }
+
+    // Take up to a batch, round robin over the workers. Packets are
+    // copied out so the workers can carry on while this batch is sent.
+    int num = 0;
+    int idle = 0;
+    while ((num < pipeline->batch) && (idle < pipeline->num_workers)) {
+      struct ring *ring = pipeline->worker[w].out;
+      w = (w + 1) % pipeline->num_workers;
+
+      uint32_t len;
+      const void *tx = ring_peek(ring, &len);
+      if (!tx) {
+        idle++;
+        continue;
+      }
+      idle = 0;
+
+      if (!num) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+      }
+      memcpy(pipeline_entry(pipeline->send, num++), tx, len);
+      ring_release(ring);
+    }
+
+    if (!num) {
+      pipeline_sleep(pipeline);
+      continue;
+    }
+
+    pipeline_flush(params, num);
+    stats_busy(pipeline->stats_tx, &start);
+  }
+
+  return NULL;
+}
+
+static int pipeline_send_setup(struct pipeline *pipeline, int num_fd,
+                               int compress) {
+  struct pipeline_send *send = calloc(1, sizeof(struct pipeline_send));
+  if (!send) {
+    return -1;
+  }
+  pipeline->send = send;
+
+  int batch = pipeline->batch;
+  send->entry = malloc((size_t)batch * PIPELINE_TX_SIZE);
+  send->cmp = compress ? malloc((size_t)batch * PROTO_BUF_SIZE) : NULL;
+  send->sent = calloc(batch, sizeof(int));
+  send->msg = calloc((size_t)num_fd * batch, sizeof(struct mmsghdr));
+  send->iov = calloc((size_t)num_fd * batch, sizeof(struct iovec));
+  send->msg_entry = calloc((size_t)num_fd * batch, sizeof(int));
+  send->count = calloc(num_fd, sizeof(int));
+  send->addr = calloc(num_fd, sizeof(struct sockaddr_in));
+
+  if (!send->entry || (compress && !send->cmp) || !send->sent ||
+      !send->msg || !send->iov || !send->msg_entry || !send->count ||
+      !send->addr) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int pipeline_setup(collector_params *params) {
+  // Records are written in packet order by a single thread
+  if (params->recorder) {
+    ERROR_COMMENT("The recorder is not used with the pipeline\n");
+    return -1;
+  }
+
+  struct pipeline *pipeline = calloc(1, sizeof(struct pipeline));
+  if (!pipeline) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return -1;
+  }
+
+  pipeline->num_workers = params->pipeline_workers;
+  pipeline->batch = params->pipeline_batch;
+  pipeline->worker = calloc(pipeline->num_workers,
+                            sizeof(struct pipeline_worker));
+  pipeline->scratch = malloc(PROTO_BUF_SIZE);
+  if (!pipeline->worker || !pipeline->scratch ||
+      pipeline_send_setup(pipeline, params->num_fd, params->compress)) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return -1;
+  }
+
+  for (int i = 0; i < pipeline->num_workers; i++) {
+    struct pipeline_worker *worker = &(pipeline->worker[i]);
+    char name[64];
+
+    worker->params = params;
+    worker->n = i;
+    worker->in = ring_create(params->pipeline_slots, PIPELINE_RX_SIZE);
+    worker->out = ring_create(params->pipeline_slots, PIPELINE_TX_SIZE);
+    if (!worker->in || !worker->out) {
+      return -1;
+    }
+
+    snprintf(name, sizeof(name), "receive_filter%d", i);
+    stats_queue(name, worker->in);
+    snprintf(name, sizeof(name), "filter%d_send", i);
+    stats_queue(name, worker->out);
+    snprintf(name, sizeof(name), "filter%d", i);
+    worker->stats = stats_worker(name);
+  }
+  pipeline->stats_rx = stats_worker("receive");
+  pipeline->stats_tx = stats_worker("send");
+
+  params->pipeline = pipeline;
+  NOTICE_PRINT("Pipeline with %d filter workers, %d slots, "
+               "batches of %d\n", pipeline->num_workers,
+               params->pipeline_slots, pipeline->batch);
+
+  return 0;
+}
+
+int pipeline_start(collector_params *params) {
+  struct pipeline *pipeline = params->pipeline;
+  pthread_t thread;
+  fd_set socks;
+  struct timespec start;
+
+  for (int i = 0; i < pipeline->num_workers; i++) {
+    if (pthread_create(&thread, NULL, pipeline_filter,
+                       &(pipeline->worker[i]))) {
+      ERROR_COMMENT("Unable to start filter thread\n");
+      return -1;
+    }
+    pthread_detach(thread);
+  }
+
+  if (pthread_create(&thread, NULL, pipeline_send, params)) {
+    ERROR_COMMENT("Unable to start send thread\n");
+    return -1;
+  }
+  pthread_detach(thread);
+
+  // This thread only receives, as listen_start()
+  while (1) {
+    FD_ZERO(&socks);
+    int maxfd = collector_fdset(params, &socks);
+    if (params->fd_netlink >= 0) {
+      FD_SET(params->fd_netlink, &socks);
+      maxfd = (params->fd_netlink > maxfd) ? params->fd_netlink : maxfd;
+    }
+
+    if (select(maxfd + 1, &socks, NULL, NULL, NULL) < 0) {
+      ERROR_COMMENT("Select failed\n");
+      continue;
+    }
+
+    // Listen sockets are updated here and relay sockets by the sender
+    if ((params->fd_netlink >= 0) && FD_ISSET(params->fd_netlink, &socks) &&
+        (iface_monitor_read(params->fd_netlink) > 0)) {
+      collector_iface_update_listen(params);
+      __atomic_store_n(&(pipeline->iface_update), 1, __ATOMIC_SEQ_CST);
+      pipeline_wake(pipeline);
+      continue;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < params->fd_listen_max; i++) {
+      if (FD_ISSET(params->fd_listen[i], &socks)) {
+        pipeline_receive(params, i);
+      }
+    }
+    stats_busy(pipeline->stats_rx, &start);
+  }
+
+  return 0;
+}
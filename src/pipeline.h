@@ -0,0 +1,109 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef SRC_PIPELINE_H_
+#define SRC_PIPELINE_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "epics.h"
+#include "ring.h"
+#include "stats.h"
+#include "collector.h"
+
+#define PIPELINE_SLOTS        1024  // Default ring size, a power of 2
+#define PIPELINE_BATCH        32    // Default datagrams per sendmmsg
+#define PIPELINE_MAX_WORKERS  16
+#define PIPELINE_MAX_BATCH    1024
+
+// Staged collector. The receive thread drains the listen sockets into
+// one SPSC ring per filter worker, round robin. Each worker parses and
+// filters, and builds the relay packets into its own ring to the send
+// thread, which compresses them and sends them in batches. A slow rule
+// set fills the rings, where drops are counted, instead of the kernel
+// socket buffers.
+
+// Datagram from the receive thread to a filter worker
+struct pipeline_rx {
+  struct timespec ts;               // Kernel receive time
+  uint32_t src_ip;
+  uint32_t dst_ip;                  // Broadcast address when received
+  uint16_t src_port;
+  uint16_t port;                    // Index into listen_ports
+  int len;
+  char data[];
+};
+
+// Relay packet from a filter worker to the send thread
+struct pipeline_tx {
+  struct timespec ts;
+  int dest;                         // Emitter, or -1 for all emitters
+  int len;                          // Header and payload
+  char data[];
+};
+
+struct pipeline_worker {
+  collector_params *params;
+  int n;
+  struct ring *in;
+  struct ring *out;
+  struct epics_packet packet;
+  struct stats_worker *stats;
+};
+
+struct pipeline_send;
+
+struct pipeline {
+  int num_workers;
+  int batch;
+  struct pipeline_worker *worker;
+  int next;                         // Worker for the next datagram
+  char *scratch;                    // Received into when all rings full
+  uint32_t doorbell;                // Rung when the sender has work
+  uint32_t sleeping;                // Sender is waiting on the doorbell
+  uint32_t iface_update;            // Relay sockets need updating
+  struct pipeline_send *send;       // Batch built by the send thread
+  struct stats_worker *stats_rx;
+  struct stats_worker *stats_tx;
+};
+
+int pipeline_setup(collector_params *params);
+int pipeline_start(collector_params *params);
+
+#endif  // SRC_PIPELINE_H_
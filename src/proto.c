@@ -0,0 +1,150 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <string.h>
+#include <sys/types.h>
+
+#include "debug.h"
+#include "epics.h"
+#include "compress.h"
+#include "proto.h"
+
+void proto_header_init(struct proto_udp_header *header) {
+  memset(header, 0, sizeof(struct proto_udp_header));
+
+  header->magic = PROTO_MAGIC_NUMBER;
+  header->version = PROTO_VERSION;
+  header->type = PROTO_TYPE;
+}
+
+int proto_header_check(const unsigned char *buffer, ssize_t len) {
+  // Check packet length
+  if (len <= (ssize_t)sizeof(struct proto_udp_header)) {
+    ERROR_PRINT("Invalid packet length %zd\n", len);
+    return -1;
+  }
+
+  const struct proto_udp_header *header =
+    (const struct proto_udp_header*)buffer;
+
+  if (header->payload_len >
+      (len - (ssize_t)sizeof(struct proto_udp_header))) {
+    ERROR_PRINT("Invalid payload length %d\n", header->payload_len);
+    return -1;
+  }
+
+  // Check magic
+
+  if (header->magic != PROTO_MAGIC_NUMBER) {
+    ERROR_PRINT("Invalid packet magic number 0x%lx\n", header->magic);
+    return -1;
+  }
+
+  if (header->version != PROTO_VERSION) {
+    ERROR_COMMENT("Invalid packet version\n");
+    return -1;
+  }
+
+  if ((header->type != PROTO_TYPE) && (header->type != PROTO_TYPE_DICT)) {
+    ERROR_COMMENT("Invalid packet type\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int proto_build_packet(struct epics_packet *packet, const char *data_src,
+                       uint64_t mask, struct compress_dict *dict,
+                       char *data_dst, char *data_cmp, char **data_out) {
+  struct proto_udp_header *header = (struct proto_udp_header*)data_dst;
+
+  int len = epics_build_packet(data_dst + sizeof(struct proto_udp_header),
+                               data_src, packet, mask);
+  if (!len) {
+    return 0;
+  }
+
+  header->payload_len = len;
+  *data_out = data_dst;
+
+  // Compress the payload if enabled
+  if (dict) {
+    uint32_t epoch;
+    int _len = compress_encode(dict, &epoch,
+                               data_cmp + sizeof(struct proto_udp_header),
+                               PROTO_BUF_SIZE -
+                               sizeof(struct proto_udp_header),
+                               data_dst + sizeof(struct proto_udp_header),
+                               len);
+    if (_len) {
+      memcpy(data_cmp, header, sizeof(struct proto_udp_header));
+      struct proto_udp_header *_header = (struct proto_udp_header*)data_cmp;
+      _header->type = PROTO_TYPE_DICT;
+      _header->dict_epoch = epoch;
+      _header->payload_len = _len;
+      *data_out = data_cmp;
+      len = _len;
+    }
+  }
+
+  return len;
+}
+
+ssize_t proto_expand_packet(struct compress_dict *dict,
+                            unsigned char *dest, ssize_t dest_size,
+                            const unsigned char *src) {
+  const struct proto_udp_header *header =
+    (const struct proto_udp_header*)src;
+
+  int len = compress_decode(dict, header->dict_epoch,
+                            (char *)dest + sizeof(struct proto_udp_header),
+                            dest_size - sizeof(struct proto_udp_header),
+                            (const char *)src +
+                            sizeof(struct proto_udp_header),
+                            header->payload_len);
+  if (!len) {
+    return 0;
+  }
+
+  memcpy(dest, src, sizeof(struct proto_udp_header));
+  struct proto_udp_header *_header = (struct proto_udp_header*)dest;
+  _header->type = PROTO_TYPE;
+  _header->payload_len = len;
+
+  return len + sizeof(struct proto_udp_header);
+}
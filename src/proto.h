@@ -39,11 +39,14 @@
 #define SRC_PROTO_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 
 #define PROTO_MAGIC_NUMBER      0x830a22b077081557
 #define PROTO_VERSION           0x01
 #define PROTO_TYPE              0x01
+#define PROTO_TYPE_DICT         0x02
 #define PROTO_UDP_PORT          4000
+#define PROTO_BUF_SIZE          2048
 
 struct proto_udp_header {
   uint64_t magic;
@@ -54,11 +57,27 @@ struct proto_udp_header {
   uint32_t dst_ip;
   uint16_t src_port;
   uint16_t dst_port;
-  uint64_t _pad1;
+  uint32_t dict_epoch;
+  uint32_t _pad1;
   uint64_t _pad2;
   uint64_t _pad3;
 } __attribute__((__packed__));
 
-// protocol "Magic:64,Version:8,Type:8,Payload Length:16,Source IP:32,Destination IP:32,Source Port:16,Destination Port:16,Reserved:192"  // NOLINT
+struct epics_packet;
+struct compress_dict;
+
+// Relay packets are a proto_udp_header followed by payload_len bytes of
+// CA / pvAccess messages, or of compressed records for PROTO_TYPE_DICT.
+
+void proto_header_init(struct proto_udp_header *header);
+int proto_header_check(const unsigned char *buffer, ssize_t len);
+int proto_build_packet(struct epics_packet *packet, const char *data_src,
+                       uint64_t mask, struct compress_dict *dict,
+                       char *data_dst, char *data_cmp, char **data_out);
+ssize_t proto_expand_packet(struct compress_dict *dict,
+                            unsigned char *dest, ssize_t dest_size,
+                            const unsigned char *src);
+
+// protocol "Magic:64,Version:8,Type:8,Payload Length:16,Source IP:32,Destination IP:32,Source Port:16,Destination Port:16,Dictionary Epoch:32,Reserved:160"  // NOLINT
 
 #endif  // SRC_PROTO_H_
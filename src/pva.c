@@ -0,0 +1,269 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <string.h>
+#include <stddef.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include "debug.h"
+#include "epics.h"
+#include "pva.h"
+
+static uint16_t pva_get_u16(const char *src, int big) {
+  uint16_t val;
+  memcpy(&val, src, sizeof(val));
+  return big ? ntohs(val) : le16toh(val);
+}
+
+static uint32_t pva_get_u32(const char *src, int big) {
+  uint32_t val;
+  memcpy(&val, src, sizeof(val));
+  return big ? ntohl(val) : le32toh(val);
+}
+
+static void pva_put_u16(char *dest, uint16_t val, int big) {
+  val = big ? htons(val) : htole16(val);
+  memcpy(dest, &val, sizeof(val));
+}
+
+static void pva_put_u32(char *dest, uint32_t val, int big) {
+  val = big ? htonl(val) : htole32(val);
+  memcpy(dest, &val, sizeof(val));
+}
+
+static int pva_get_size(const char *src, int *pos, int end, int big) {
+  // Size encoding, 255 is a null string, 254 a 32 bit size
+  if (*pos >= end) {
+    return -1;
+  }
+
+  uint8_t size = src[(*pos)++];
+  if (size == 255) {
+    return 0;
+  }
+  if (size < 254) {
+    return size;
+  }
+
+  if ((end - *pos) < 4) {
+    return -1;
+  }
+  int32_t _size = pva_get_u32(src + *pos, big);
+  *pos += 4;
+  return _size;
+}
+
+int pva_message_len(const char *src, int len) {
+  const struct pva_header *hdr = (const struct pva_header *)src;
+
+  if (len < (int)sizeof(struct pva_header)) {
+    return -1;
+  }
+
+  if (hdr->flags & PVA_FLAG_CONTROL) {
+    // Control messages have no payload
+    return sizeof(struct pva_header);
+  }
+
+  uint32_t size = pva_get_u32((const char *)&(hdr->payload_size),
+                              hdr->flags & PVA_FLAG_BIG_ENDIAN);
+  if (size > (uint32_t)(len - sizeof(struct pva_header))) {
+    return -1;
+  }
+
+  return sizeof(struct pva_header) + size;
+}
+
+static int pva_parse_search(struct epics_packet *packet, const char *src,
+                            int pos, int end,
+                            struct epics_filter_set *filters) {
+  const struct pva_header *hdr = (const struct pva_header *)(src + pos);
+  int big = hdr->flags & PVA_FLAG_BIG_ENDIAN;
+  struct epics_frame *frame = &(packet->frame[packet->num_frames]);
+  int _pos = pos + sizeof(struct pva_header);
+
+  if ((end - _pos) < (int)sizeof(struct pva_search)) {
+    return -1;
+  }
+  DEBUG_PRINT("PVA search sequence %u\n",
+              pva_get_u32(src + _pos, big));
+  _pos += sizeof(struct pva_search);
+
+  // Skip list of protocols
+  int protocols = pva_get_size(src, &_pos, end, big);
+  if (protocols < 0) {
+    return -1;
+  }
+  for (int i = 0; i < protocols; i++) {
+    int size = pva_get_size(src, &_pos, end, big);
+    if ((size < 0) || (size > (end - _pos))) {
+      return -1;
+    }
+    _pos += size;
+  }
+
+  if ((end - _pos) < 2) {
+    return -1;
+  }
+  int count = pva_get_u16(src + _pos, big);
+  _pos += 2;
+
+  if ((packet->num_frames + 1 + count) > EPICS_MAX_FRAMES) {
+    ERROR_PRINT("Too many channels (%d) in PVA search\n", count);
+    return -1;
+  }
+
+  // Header up to and including the channel count
+  frame->offset = pos;
+  frame->len = _pos - pos;
+  frame->type = EPICS_TYPE_PVA_SEARCH;
+  frame->mask = EPICS_MASK_ALL;
+
+  for (int i = 0; i < count; i++) {
+    struct epics_frame *channel = frame + 1 + i;
+    channel->offset = _pos;
+    channel->type = EPICS_TYPE_PVA_CHANNEL;
+
+    // Search instance ID then name
+    if ((end - _pos) < 4) {
+      return -1;
+    }
+    _pos += 4;
+    int size = pva_get_size(src, &_pos, end, big);
+    if ((size < 0) || (size > (end - _pos))) {
+      return -1;
+    }
+
+    DEBUG_PRINT("PVA Channel : %.*s\n", size, src + _pos);
+    channel->mask = epics_filter_mask(filters, src + _pos, size);
+    _pos += size;
+    channel->len = _pos - channel->offset;
+
+    packet->search++;
+    packet->mask |= channel->mask;
+  }
+
+  if (_pos != end) {
+    return -1;
+  }
+
+  packet->num_frames += 1 + count;
+  return 0;
+}
+
+int pva_parse_message(struct epics_packet *packet, const char *src,
+                      int pos, int len, struct epics_filter_set *filters) {
+  const struct pva_header *hdr = (const struct pva_header *)(src + pos);
+
+  int _len = pva_message_len(src + pos, len - pos);
+  if (_len < 0) {
+    DEBUG_COMMENT("Truncated PVA message\n");
+    return -1;
+  }
+
+  DEBUG_PRINT("PVA command : %d flags 0x%x\n", hdr->command, hdr->flags);
+
+  if (!(hdr->flags & (PVA_FLAG_CONTROL | PVA_FLAG_SEGMENTED |
+                      PVA_FLAG_SERVER)) &&
+      (hdr->command == PVA_CMD_SEARCH)) {
+    DEBUG_COMMENT("Valid PVA search\n");
+    int num_frames = packet->num_frames;
+    int search = packet->search;
+    uint64_t mask = packet->mask;
+    if (!pva_parse_search(packet, src, pos, pos + _len, filters)) {
+      return _len;
+    }
+
+    // Relay as is if we cannot make sense of it
+    ERROR_COMMENT("Malformed PVA search\n");
+    packet->num_frames = num_frames;
+    packet->search = search;
+    packet->mask = mask;
+  }
+
+  struct epics_frame *frame = &(packet->frame[packet->num_frames++]);
+  frame->offset = pos;
+  frame->len = _len;
+  frame->type = EPICS_TYPE_NONE;
+  frame->mask = EPICS_MASK_ALL;
+
+  if (hdr->command == PVA_CMD_BEACON) {
+    DEBUG_COMMENT("Valid PVA beacon\n");
+    frame->type = EPICS_TYPE_BEACON;
+  }
+
+  return _len;
+}
+
+int pva_build_search(char *dest, const char *src,
+                     struct epics_packet *packet, int *index,
+                     uint64_t mask, int *search) {
+  struct epics_frame *frame = &(packet->frame[*index]);
+  const struct pva_header *hdr =
+    (const struct pva_header *)(src + frame->offset);
+  int big = hdr->flags & PVA_FLAG_BIG_ENDIAN;
+  int count = pva_get_u16(src + frame->offset + frame->len - 2, big);
+
+  memcpy(dest, src + frame->offset, frame->len);
+  int pos = frame->len;
+  int accepted = 0;
+
+  for (int i = 1; i <= count; i++) {
+    struct epics_frame *channel = frame + i;
+    if (channel->mask & mask) {
+      memcpy(dest + pos, src + channel->offset, channel->len);
+      pos += channel->len;
+      accepted++;
+    }
+  }
+  *index += count;
+
+  if (count && !accepted) {
+    // Drop the message
+    return 0;
+  }
+
+  // Fix up the channel count and payload size
+  pva_put_u16(dest + frame->len - 2, accepted, big);
+  pva_put_u32(dest + offsetof(struct pva_header, payload_size),
+              pos - sizeof(struct pva_header), big);
+
+  *search += accepted;
+  return pos;
+}
@@ -0,0 +1,77 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef SRC_PVA_H_
+#define SRC_PVA_H_
+
+#include <stdint.h>
+
+#include "epics.h"
+
+#define PVA_MAGIC             0xCA
+#define PVA_CMD_BEACON        0x00
+#define PVA_CMD_SEARCH        0x03
+
+#define PVA_FLAG_CONTROL      0x01
+#define PVA_FLAG_SEGMENTED    0x30
+#define PVA_FLAG_SERVER       0x40
+#define PVA_FLAG_BIG_ENDIAN   0x80
+
+struct pva_header {
+  uint8_t magic;
+  uint8_t version;
+  uint8_t flags;
+  uint8_t command;
+  uint32_t payload_size;
+} __attribute__((__packed__));
+
+struct pva_search {
+  uint32_t sequence_id;
+  uint8_t flags;
+  uint8_t reserved[3];
+  uint8_t address[16];
+  uint16_t port;
+} __attribute__((__packed__));
+
+int pva_message_len(const char *src, int len);
+int pva_parse_message(struct epics_packet *packet, const char *src,
+                      int pos, int len, struct epics_filter_set *filters);
+int pva_build_search(char *dest, const char *src,
+                     struct epics_packet *packet, int *index,
+                     uint64_t mask, int *search);
+
+#endif  // SRC_PVA_H_
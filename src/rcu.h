@@ -0,0 +1,66 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef SRC_RCU_H_
+#define SRC_RCU_H_
+
+#include <stdint.h>
+
+#define RCU_CACHE_LINE    64
+
+// Quiescent state tracking for data published by pointer swap. Each
+// reader thread has its own counter which is odd while it is inside a
+// read side section. A writer swaps the pointer, waits for every
+// reader to leave the section it may have been in, then frees the
+// old copy.
+
+struct rcu_reader {
+  uint32_t ctr;
+} __attribute__((aligned(RCU_CACHE_LINE)));
+
+static inline void rcu_read_lock(struct rcu_reader *reader) {
+  __atomic_add_fetch(&reader->ctr, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void rcu_read_unlock(struct rcu_reader *reader) {
+  __atomic_add_fetch(&reader->ctr, 1, __ATOMIC_RELEASE);
+}
+
+void rcu_synchronize(struct rcu_reader *readers, int num_readers);
+
+#endif  // SRC_RCU_H_
@@ -0,0 +1,315 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pcap.h>
+
+#include "ethernet.h"
+#include "epics.h"
+#include "pva.h"
+#include "recorder.h"
+
+// Converts the file of the collector recorder to text or to a pcap
+// file of raw IP packets. The file may be read while the collector
+// is still writing to it.
+
+static const char *verdict_name[RECORDER_NUM_VERDICT] = {
+  "foreign", "invalid", "filtered", "relayed", "failed"
+};
+
+static struct option long_options[] = {
+  {"pcap", required_argument, 0, 'p'},
+  {"minutes", required_argument, 0, 'm'},
+  {"verbose", no_argument, 0, 'v'},
+  {0, 0, 0, 0}
+};
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: epics_relay_dump [-p file.pcap] [-m minutes] [-v] file\n");
+}
+
+static void dump_messages(const struct recorder_record *record) {
+  int pos = 0;
+
+  while ((pos + (int)sizeof(struct ca_proto_msg)) <= record->caplen) {
+    if (record->data[pos] == PVA_MAGIC) {
+      printf("    pva\n");
+      return;
+    }
+
+    const struct ca_proto_msg *msg =
+      (const struct ca_proto_msg *)(record->data + pos);
+    int size = sizeof(struct ca_proto_msg) + ntohs(msg->payload_size);
+    int command = ntohs(msg->command);
+
+    if (command == CA_PROTO_SEARCH) {
+      const char *pv = (const char *)record->data + pos +
+                       sizeof(struct ca_proto_search);
+      int max = record->caplen - pos - (int)sizeof(struct ca_proto_search);
+      int len = max > 0 ? strnlen(pv, max) : 0;
+      printf("    search %.*s%s\n", len, pv,
+             (pos + size) > record->caplen ? " (truncated)" : "");
+    } else if (command == CA_PROTO_RSRV_IS_UP) {
+      printf("    beacon\n");
+    } else if (command == CA_PROTO_VERSION) {
+      printf("    version\n");
+    } else {
+      printf("    command %d\n", command);
+    }
+    pos += size;
+  }
+}
+
+static void dump_text(const struct recorder_record *record, int verbose) {
+  char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+  char date[32];
+  struct tm tm;
+
+  time_t sec = record->ts / 1000000000;
+  localtime_r(&sec, &tm);
+  strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+  inet_ntop(AF_INET, &(record->src_ip), src, sizeof(src));
+  inet_ntop(AF_INET, &(record->dst_ip), dst, sizeof(dst));
+
+  printf("%s.%06lu %s:%u > %s:%u %u bytes %s", date,
+         (unsigned long)(record->ts % 1000000000) / 1000, src,
+         record->src_port, dst, record->dst_port, record->len,
+         record->verdict < RECORDER_NUM_VERDICT ?
+         verdict_name[record->verdict] : "unknown");
+  if (record->verdict == RECORDER_RELAYED) {
+    printf(" 0x%lx", (unsigned long)record->mask);
+  }
+  if (record->num_frames) {
+    printf(" frames %u search %u", record->num_frames, record->search);
+  }
+  printf("\n");
+
+  if (verbose) {
+    dump_messages(record);
+  }
+}
+
+static uint16_t dump_checksum(const void *data, int len) {
+  const uint16_t *word = data;
+  uint32_t sum = 0;
+
+  for (int i = 0; i < len / 2; i++) {
+    sum += word[i];
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+
+  return ~sum;
+}
+
+static void dump_pcap(pcap_dumper_t *dumper,
+                      const struct recorder_record *record) {
+  unsigned char packet[sizeof(struct ipbdy) + sizeof(struct udphdr) +
+                       UINT16_MAX];
+  struct ipbdy *ip = (struct ipbdy *)packet;
+  struct udphdr *udp = (struct udphdr *)(packet + sizeof(struct ipbdy));
+  int header = sizeof(struct ipbdy) + sizeof(struct udphdr);
+
+  // Rebuild the headers the kernel stripped, lengths are the original
+  memset(packet, 0, header);
+  ip->ver_ihl = 0x45;
+  ip->tlen = htons(header + record->len);
+  ip->ttl = 64;
+  ip->proto = IPPROTO_UDP;
+  ip->ip_sip.s_addr = record->src_ip;
+  ip->ip_dip.s_addr = record->dst_ip;
+  ip->crc = dump_checksum(ip, sizeof(struct ipbdy));
+  udp->sport = htons(record->src_port);
+  udp->dport = htons(record->dst_port);
+  udp->len = htons(sizeof(struct udphdr) + record->len);
+  memcpy(packet + header, record->data, record->caplen);
+
+  struct pcap_pkthdr hdr;
+  hdr.ts.tv_sec = record->ts / 1000000000;
+  hdr.ts.tv_usec = (record->ts % 1000000000) / 1000;
+  hdr.caplen = header + record->caplen;
+  hdr.len = header + record->len;
+  pcap_dump((unsigned char *)dumper, &hdr, packet);
+}
+
+int main(int argc, char *argv[]) {
+  const char *pcap_file = NULL;
+  int minutes = 0;
+  int verbose = 0;
+
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "p:m:v", long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 'p':
+      pcap_file = optarg;
+      break;
+    case 'm':
+      minutes = atoi(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case '?':
+    default:
+      usage();
+      exit(-1);
+      break;
+    }
+  }
+
+  if ((optind != (argc - 1)) || (minutes < 0)) {
+    usage();
+    exit(-1);
+  }
+
+  const char *filename = argv[optind];
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if ((fd < 0) || fstat(fd, &st)) {
+    perror(filename);
+    exit(-1);
+  }
+
+  if ((size_t)st.st_size < RECORDER_HEADER) {
+    fprintf(stderr, "%s is not a recorder file\n", filename);
+    exit(-1);
+  }
+
+  struct recorder_file *file = mmap(NULL, st.st_size, PROT_READ,
+                                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    perror(filename);
+    exit(-1);
+  }
+
+  if ((file->magic != RECORDER_MAGIC) ||
+      (file->version != RECORDER_VERSION) ||
+      ((size_t)st.st_size < (RECORDER_HEADER +
+                             file->num_records * file->record_size))) {
+    fprintf(stderr, "%s is not a recorder file\n", filename);
+    exit(-1);
+  }
+
+  pcap_t *pcap = NULL;
+  pcap_dumper_t *dumper = NULL;
+  if (pcap_file) {
+    pcap = pcap_open_dead(DLT_RAW, sizeof(struct ipbdy) +
+                          sizeof(struct udphdr) + file->snaplen);
+    if (!pcap || !(dumper = pcap_dump_open(pcap, pcap_file))) {
+      fprintf(stderr, "Unable to open %s\n", pcap_file);
+      exit(-1);
+    }
+  }
+
+  uint64_t head = __atomic_load_n(&file->head, __ATOMIC_ACQUIRE);
+  uint64_t first = (head > file->num_records) ?
+                   head - file->num_records : 0;
+
+  // The window is counted back from the newest record
+  uint64_t since = 0;
+  if (minutes && head) {
+    uint64_t last = recorder_record(file, head - 1)->ts;
+    uint64_t window = (uint64_t)minutes * 60 * 1000000000;
+    since = (last > window) ? last - window : 0;
+  }
+
+  struct recorder_record *record = malloc(file->record_size);
+  if (!record) {
+    fprintf(stderr, "Unable to allocate memory\n");
+    exit(-1);
+  }
+
+  uint64_t num = 0;
+  uint64_t skipped = 0;
+  for (uint64_t i = first; i < head; i++) {
+    struct recorder_record *_record = recorder_record(file, i);
+
+    // Copy out and check the writer did not overwrite it meanwhile
+    uint64_t seq = __atomic_load_n(&_record->seq, __ATOMIC_ACQUIRE);
+    memcpy(record, _record, file->record_size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if ((seq != (i + 1)) ||
+        (__atomic_load_n(&_record->seq, __ATOMIC_RELAXED) != seq) ||
+        (record->caplen > file->snaplen)) {
+      skipped++;
+      continue;
+    }
+
+    if (record->ts < since) {
+      continue;
+    }
+
+    if (dumper) {
+      dump_pcap(dumper, record);
+    } else {
+      dump_text(record, verbose);
+    }
+    num++;
+  }
+
+  if (dumper) {
+    pcap_dump_close(dumper);
+    pcap_close(pcap);
+  }
+
+  fprintf(stderr, "%lu datagrams, %lu overwritten while reading\n",
+          (unsigned long)num, (unsigned long)skipped);
+
+  free(record);
+  munmap(file, st.st_size);
+  return 0;
+}
@@ -0,0 +1,149 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "recorder.h"
+
+struct recorder* recorder_open(const char *path, uint64_t num_records,
+                               uint32_t snaplen) {
+  if (!num_records || (snaplen > UINT16_MAX)) {
+    ERROR_PRINT("Invalid recorder size for %s\n", path);
+    return NULL;
+  }
+
+  struct recorder *rec = calloc(1, sizeof(struct recorder));
+  if (!rec) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return NULL;
+  }
+
+  uint32_t record_size = recorder_record_size(snaplen);
+  rec->size = RECORDER_HEADER + num_records * record_size;
+
+  int fd = open(path, O_RDWR | O_CREAT, 0640);
+  if (fd < 0) {
+    ERROR_PRINT("Unable to open recorder file %s : %s\n", path,
+                strerror(errno));
+    free(rec);
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st)) {
+    ERROR_PRINT("Unable to stat recorder file %s\n", path);
+    goto _error;
+  }
+
+  // The file is sized once, the pages are only written as records are
+  if (((size_t)st.st_size != rec->size) && ftruncate(fd, rec->size)) {
+    ERROR_PRINT("Unable to size recorder file %s : %s\n", path,
+                strerror(errno));
+    goto _error;
+  }
+
+  // Fault the pages in now rather than on the packet path
+  rec->file = mmap(NULL, rec->size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, 0);
+  if (rec->file == MAP_FAILED) {
+    ERROR_PRINT("Unable to map recorder file %s\n", path);
+    goto _error;
+  }
+  close(fd);
+
+  // A file left by an earlier run is appended to, so a restart keeps
+  // the traffic that led up to it
+  struct recorder_file *file = rec->file;
+  if ((file->magic != RECORDER_MAGIC) ||
+      (file->version != RECORDER_VERSION) ||
+      (file->record_size != record_size) || (file->snaplen != snaplen) ||
+      (file->num_records != num_records)) {
+    memset(file, 0, RECORDER_HEADER);
+    file->version = RECORDER_VERSION;
+    file->record_size = record_size;
+    file->snaplen = snaplen;
+    file->num_records = num_records;
+    __atomic_store_n(&file->magic, RECORDER_MAGIC, __ATOMIC_RELEASE);
+  }
+
+  rec->head = file->head;
+  rec->slot = rec->head % num_records;
+
+  NOTICE_PRINT("Recording %lu datagrams of up to %u bytes to %s\n",
+               (unsigned long)num_records, snaplen, path);
+  return rec;
+
+_error:
+  close(fd);
+  free(rec);
+  return NULL;
+}
+
+void recorder_close(struct recorder *rec) {
+  munmap(rec->file, rec->size);
+  free(rec);
+}
+
+struct recorder_record* recorder_reserve(struct recorder *rec) {
+  struct recorder_record *record = (struct recorder_record*)
+    ((char *)rec->file + RECORDER_HEADER +
+     rec->slot * rec->file->record_size);
+
+  // Readers skip the record until it is committed again
+  __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  return record;
+}
+
+void recorder_commit(struct recorder *rec, struct recorder_record *record) {
+  rec->head++;
+  if (++rec->slot == rec->file->num_records) {
+    rec->slot = 0;
+  }
+
+  __atomic_store_n(&record->seq, rec->head, __ATOMIC_RELEASE);
+  __atomic_store_n(&rec->file->head, rec->head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,120 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef SRC_RECORDER_H_
+#define SRC_RECORDER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RECORDER_MAGIC      0x52454344  // "RECD"
+#define RECORDER_VERSION    2
+#define RECORDER_HEADER     4096        // File header, one page
+#define RECORDER_ALIGN      64
+#define RECORDER_SNAPLEN    208         // Default bytes kept of a datagram
+#define RECORDER_MINUTES    10          // Default window to size the file
+#define RECORDER_RATE       1000        // Default datagrams/s to size for
+
+// Flight recorder of the datagrams seen by the collector. The file is
+// a header followed by fixed size records used as a circular buffer,
+// it is mapped shared so appending is a copy into the page cache and
+// the records survive the process. head is the free running count of
+// records written. The writer clears seq while filling a record and
+// sets it to its index + 1 when done, so a reader can tell complete
+// records from ones being overwritten.
+
+enum recorder_verdict {
+  RECORDER_FOREIGN = 0,   // Not from the listen subnet
+  RECORDER_INVALID,       // No CA or PVA messages found
+  RECORDER_FILTERED,      // Nothing left for any emitter
+  RECORDER_RELAYED,       // Sent to the emitters in mask
+  RECORDER_FAILED,        // Sending failed or emitter unresolved
+  RECORDER_NUM_VERDICT
+};
+
+struct recorder_file {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t snaplen;
+  uint64_t num_records;
+  uint64_t head __attribute__((aligned(RECORDER_ALIGN)));
+};
+
+struct recorder_record {
+  uint64_t seq;
+  uint64_t ts;              // Receive time, ns since the epoch
+  uint32_t src_ip;          // Network byte order
+  uint32_t dst_ip;
+  uint16_t src_port;        // Host byte order
+  uint16_t dst_port;
+  uint16_t len;             // Length of the datagram
+  uint16_t caplen;          // Bytes of it in data
+  uint16_t num_frames;      // Up to EPICS_MAX_FRAMES
+  uint16_t search;
+  uint8_t verdict;
+  uint8_t _pad[3];
+  uint64_t mask;            // Emitters the datagram was sent to
+  unsigned char data[];
+};
+
+struct recorder {
+  struct recorder_file *file;
+  size_t size;
+  uint64_t head;
+  uint64_t slot;
+};
+
+struct recorder* recorder_open(const char *path, uint64_t num_records,
+                               uint32_t snaplen);
+void recorder_close(struct recorder *rec);
+struct recorder_record* recorder_reserve(struct recorder *rec);
+void recorder_commit(struct recorder *rec, struct recorder_record *record);
+
+static inline size_t recorder_record_size(uint32_t snaplen) {
+  size_t size = sizeof(struct recorder_record) + snaplen;
+  return (size + RECORDER_ALIGN - 1) & ~(size_t)(RECORDER_ALIGN - 1);
+}
+
+static inline struct recorder_record* recorder_record(
+    struct recorder_file *file, uint64_t n) {
+  return (struct recorder_record*)((char *)file + RECORDER_HEADER +
+                                   (n % file->num_records) *
+                                   file->record_size);
+}
+
+#endif  // SRC_RECORDER_H_
@@ -0,0 +1,252 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+
+#include "ethernet.h"
+#include "debug.h"
+#include "proto.h"
+#include "collector.h"
+#include "emitter.h"
+#include "defs.h"
+#include "config.h"
+#include "control.h"
+#include "resolver.h"
+#include "stats.h"
+#include "daemon.h"
+
+extern const char* EPICS_RELAY_GIT_REV;
+extern const char* EPICS_RELAY_GIT_BRANCH;
+extern const char* EPICS_RELAY_GIT_VERSION;
+
+static struct option long_options[] = {
+  {"debug", no_argument, &debug_flag, -1},
+  {"config", required_argument, 0, 'c'},
+  {0, 0, 0, 0}
+};
+
+typedef struct {
+  collector_params collector;
+  emitter_params emitter;
+  // Packets are handled one at a time so both roles share these
+  char data_src[PROTO_BUF_SIZE];
+  char data_cmp[PROTO_BUF_SIZE];
+} relay_params;
+
+int relay_setup(relay_params *params) {
+  params->collector.data_src = params->data_src;
+  params->collector.data_cmp = params->data_cmp;
+  params->emitter.buffer = (unsigned char *)params->data_src;
+  params->emitter.buffer_dict = (unsigned char *)params->data_cmp;
+
+  // Both roles are already in the one process
+  if (params->collector.shm || params->emitter.shm) {
+    ERROR_COMMENT("Shared memory is not used by epics_relay\n");
+    return -1;
+  }
+
+  // Packets are handled one at a time between both roles
+  if (params->collector.pipeline_workers) {
+    ERROR_COMMENT("The pipeline is not used by epics_relay\n");
+    return -1;
+  }
+
+  if (collector_setup(&(params->collector))) {
+    ERROR_COMMENT("Unable to setup collector\n");
+    return -1;
+  }
+
+  if (emitter_setup(&(params->emitter))) {
+    ERROR_COMMENT("Unable to setup emitter\n");
+    return -1;
+  }
+
+  // One interface monitor updates both roles
+  if (params->emitter.fd_netlink >= 0) {
+    close(params->emitter.fd_netlink);
+    params->emitter.fd_netlink = -1;
+  }
+
+  return 0;
+}
+
+void relay_start(relay_params *params) {
+  fd_set socks;
+
+  // Loop forever!
+  while (1) {
+    FD_ZERO(&socks);
+    int maxfd = collector_fdset(&(params->collector), &socks);
+    FD_SET(params->emitter.fd, &socks);
+    if (params->emitter.fd > maxfd) {
+      maxfd = params->emitter.fd;
+    }
+    int fd_netlink = params->collector.fd_netlink;
+    if (fd_netlink >= 0) {
+      FD_SET(fd_netlink, &socks);
+      maxfd = (fd_netlink > maxfd) ? fd_netlink : maxfd;
+    }
+
+    if (select(maxfd + 1, &socks, NULL, NULL, NULL) < 0) {
+      ERROR_COMMENT("Select failed\n");
+      continue;
+    }
+
+    // Interface changes are applied between packets
+    if ((fd_netlink >= 0) && FD_ISSET(fd_netlink, &socks) &&
+        (iface_monitor_read(fd_netlink) > 0)) {
+      collector_iface_update(&(params->collector));
+      emitter_iface_update(&(params->emitter));
+      continue;
+    }
+
+    // Relay traffic from the local subnet
+    for (int i = 0; i < params->collector.fd_listen_max; i++) {
+      if (FD_ISSET(params->collector.fd_listen[i], &socks)) {
+        collector_receive(&(params->collector), i);
+      }
+    }
+
+    // Rebroadcast traffic from remote collectors
+    if (FD_ISSET(params->emitter.fd, &socks)) {
+      if (emitter_receive(&(params->emitter))) {
+        ERROR_COMMENT("Emitter failed ... exiting\n");
+        return;
+      }
+    }
+  }
+}
+
+static void* relay_thread(void *arg) {
+  relay_params *params = arg;
+
+  relay_start(params);
+
+  close_libnet(&(params->emitter.libnet));
+  close(params->emitter.fd);
+
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  relay_params *params;
+  char *config_file = DEFAULT_CONFIG_FILE;
+
+  if (log_start()) {
+    ERROR_COMMENT("Unable to start logging thread\n");
+    exit(-1);
+  }
+  if (daemon_signals()) {
+    exit(-1);
+  }
+
+  // Clients of the control socket may hang up before their reply
+  signal(SIGPIPE, SIG_IGN);
+  NOTICE_PRINT("Verstion : %s (%s)\n",
+               EPICS_RELAY_GIT_VERSION, EPICS_RELAY_GIT_REV);
+
+  // Parse command line options
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "dc:",
+                        long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 0:
+      break;
+    case 'd':
+      debug_flag = -1;
+      break;
+    case 'c':
+      config_file = optarg;
+      break;
+    case '?':
+    default:
+      exit(-1);
+      break;
+    }
+  }
+
+  params = calloc(1, sizeof(relay_params));
+  if (!params) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    exit(-1);
+  }
+
+  if (config_read_relay(config_file, &(params->collector),
+                        &(params->emitter))) {
+    ERROR_COMMENT("Unable to process config file\n");
+    exit(-1);
+  }
+
+  if (relay_setup(params)) {
+    exit(-1);
+  }
+
+  if (collector_reload_start(&(params->collector), config_file)) {
+    exit(-1);
+  }
+
+  if (control_start(&(params->collector))) {
+    exit(-1);
+  }
+
+  if (resolver_start(&(params->collector))) {
+    exit(-1);
+  }
+
+  // Counters are per process, so one exporter serves both roles
+  struct stats_config *stats = &(params->collector.stats);
+  if (!stats->port && !stats->path[0]) {
+    stats = &(params->emitter.stats);
+  }
+  if (stats_start(stats)) {
+    exit(-1);
+  }
+
+  daemon_run(relay_thread, params);
+}
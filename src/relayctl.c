@@ -0,0 +1,139 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+static struct option long_options[] = {
+  {"socket", required_argument, 0, 's'},
+  {0, 0, 0, 0}
+};
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: epics_relay_ctl [-s socket] list\n"
+          "       epics_relay_ctl [-s socket] add <target> <regex>\n"
+          "       epics_relay_ctl [-s socket] del <target> <regex>\n"
+          "\n"
+          "target is \"global\" or the index of the emitter\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = CONTROL_SOCKET;
+
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "s:", long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 's':
+      path = optarg;
+      break;
+    case '?':
+    default:
+      usage();
+      exit(-1);
+      break;
+    }
+  }
+
+  if (optind >= argc) {
+    usage();
+    exit(-1);
+  }
+
+  // The arguments make up one command line
+  char line[CONTROL_LINE_MAX];
+  line[0] = '\0';
+  for (int i = optind; i < argc; i++) {
+    if ((strlen(line) + strlen(argv[i]) + 2) > sizeof(line)) {
+      fprintf(stderr, "Command too long\n");
+      exit(-1);
+    }
+    strcat(line, argv[i]);
+    strcat(line, (i == argc - 1) ? "\n" : " ");
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((fd < 0) ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    perror(path);
+    exit(-1);
+  }
+
+  FILE *stream = fdopen(fd, "r+");
+  if (!stream) {
+    perror("fdopen");
+    exit(-1);
+  }
+
+  fputs(line, stream);
+  fflush(stream);
+
+  // Print the reply up to the status line
+  int rc = -1;
+  while (fgets(line, sizeof(line), stream)) {
+    if (!strcmp(line, "OK\n")) {
+      rc = 0;
+      break;
+    }
+    if (!strncmp(line, "ERROR", 5)) {
+      fputs(line, stderr);
+      break;
+    }
+    fputs(line, stdout);
+  }
+
+  fclose(stream);
+  return rc ? 1 : 0;
+}
@@ -0,0 +1,521 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pcap.h>
+
+#include "ethernet.h"
+#include "epics.h"
+
+// Replays the UDP payloads of CA and PVA broadcasts from a capture
+// file toward a collector. The datagrams are loaded into memory first
+// so reading the file does not disturb the timing, then sent with the
+// original spacing, scaled by the speed up factor, or back to back.
+
+#define REPLAY_LINUX_SLL_SIZE   16
+#define REPLAY_LATE_NS          1000000     // Count datagrams later than this
+
+struct replay_datagram {
+  uint64_t offset;            // ns since the first datagram
+  uint16_t port;              // Original destination port
+  uint16_t len;
+  size_t data;                // Offset into the payload buffer
+};
+
+struct replay_capture {
+  struct replay_datagram *datagram;
+  int num;
+  int size;
+  char *payload;
+  size_t payload_len;
+  size_t payload_size;
+  int skipped;
+};
+
+struct replay_counters {
+  uint64_t received;
+  uint64_t drops;
+  uint64_t accept;
+  uint64_t reject;
+  uint64_t sent;
+  uint64_t errors;
+};
+
+static struct option long_options[] = {
+  {"address", required_argument, 0, 'a'},
+  {"interface", required_argument, 0, 'i'},
+  {"speed", required_argument, 0, 'x'},
+  {"fast", no_argument, 0, 'f'},
+  {"loops", required_argument, 0, 'l'},
+  {"stats", required_argument, 0, 's'},
+  {"wait", required_argument, 0, 'w'},
+  {0, 0, 0, 0}
+};
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: epics_relay_replay (-a address | -i interface) [-x speed]"
+          " [-f]\n"
+          "                          [-l loops] [-s stats_socket] [-w ms]"
+          " file.pcap\n");
+}
+
+static uint64_t replay_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void replay_sleep(uint64_t until) {
+  struct timespec ts;
+  ts.tv_sec = until / 1000000000;
+  ts.tv_nsec = until % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {
+  }
+}
+
+static int replay_is_epics(uint16_t port) {
+  return (port == EPICS_CA_SERVER_PORT) ||
+         (port == EPICS_CA_REPEATER_PORT) ||
+         (port == EPICS_PVA_BROADCAST_PORT);
+}
+
+// Returns the offset of the IPv4 header, or -1 for anything else
+static int replay_link_size(int linktype, const u_char *packet,
+                            uint32_t caplen) {
+  switch (linktype) {
+  case DLT_EN10MB:
+    if (caplen < sizeof(struct ethernet_header_8021q)) {
+      return -1;
+    }
+    const struct ethernet_header *eth =
+      (const struct ethernet_header *)packet;
+    if (ntohs(eth->ether_type) == ETHERTYPE_IP) {
+      return sizeof(struct ethernet_header);
+    }
+    const struct ethernet_header_8021q *vlan =
+      (const struct ethernet_header_8021q *)packet;
+    if ((ntohs(vlan->tpid) == ETHERTYPE_8021Q) &&
+        (ntohs(vlan->ether_type) == ETHERTYPE_IP)) {
+      return sizeof(struct ethernet_header_8021q);
+    }
+    return -1;
+  case DLT_LINUX_SLL:
+    if ((caplen < REPLAY_LINUX_SLL_SIZE) ||
+        (((packet[14] << 8) | packet[15]) != ETHERTYPE_IP)) {
+      return -1;
+    }
+    return REPLAY_LINUX_SLL_SIZE;
+  case DLT_RAW:
+  case DLT_IPV4:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+static int replay_add(struct replay_capture *cap, uint64_t offset,
+                      uint16_t port, const u_char *data, uint16_t len) {
+  if (cap->num == cap->size) {
+    int size = cap->size ? cap->size * 2 : 4096;
+    struct replay_datagram *datagram =
+      realloc(cap->datagram, size * sizeof(struct replay_datagram));
+    if (!datagram) {
+      return -1;
+    }
+    cap->datagram = datagram;
+    cap->size = size;
+  }
+
+  if ((cap->payload_len + len) > cap->payload_size) {
+    size_t size = cap->payload_size ? cap->payload_size * 2 : 1 << 20;
+    while (size < (cap->payload_len + len)) {
+      size *= 2;
+    }
+    char *payload = realloc(cap->payload, size);
+    if (!payload) {
+      return -1;
+    }
+    cap->payload = payload;
+    cap->payload_size = size;
+  }
+
+  struct replay_datagram *datagram = &(cap->datagram[cap->num++]);
+  datagram->offset = offset;
+  datagram->port = port;
+  datagram->len = len;
+  datagram->data = cap->payload_len;
+  memcpy(cap->payload + cap->payload_len, data, len);
+  cap->payload_len += len;
+
+  return 0;
+}
+
+static int replay_load(const char *filename, struct replay_capture *cap) {
+  char errbuf[PCAP_ERRBUF_SIZE];
+  pcap_t *pcap = pcap_open_offline(filename, errbuf);
+  if (!pcap) {
+    fprintf(stderr, "%s\n", errbuf);
+    return -1;
+  }
+
+  int linktype = pcap_datalink(pcap);
+  struct pcap_pkthdr *hdr;
+  const u_char *packet;
+  uint64_t first = 0;
+  int rc;
+
+  memset(cap, 0, sizeof(struct replay_capture));
+
+  while ((rc = pcap_next_ex(pcap, &hdr, &packet)) == 1) {
+    int offset = replay_link_size(linktype, packet, hdr->caplen);
+    if ((offset < 0) ||
+        ((offset + sizeof(struct ipbdy)) > hdr->caplen)) {
+      cap->skipped++;
+      continue;
+    }
+
+    // Skip anything but complete, unfragmented UDP datagrams
+    const struct ipbdy *ip = (const struct ipbdy *)(packet + offset);
+    int ihl = (ip->ver_ihl & 0x0F) * 4;
+    if (((ip->ver_ihl >> 4) != 4) || (ip->proto != IPPROTO_UDP) ||
+        (ntohs(ip->flags_fo) & 0x3FFF) ||
+        ((offset + ihl + sizeof(struct udphdr)) > hdr->caplen)) {
+      cap->skipped++;
+      continue;
+    }
+
+    const struct udphdr *udp = (const struct udphdr *)(packet + offset + ihl);
+    uint16_t port = ntohs(udp->dport);
+    int len = ntohs(udp->len) - (int)sizeof(struct udphdr);
+    const u_char *data = (const u_char *)udp + sizeof(struct udphdr);
+    if (!replay_is_epics(port) || (len <= 0) ||
+        ((data + len) > (packet + hdr->caplen))) {
+      cap->skipped++;
+      continue;
+    }
+
+    uint64_t ts = (uint64_t)hdr->ts.tv_sec * 1000000000 +
+                  (uint64_t)hdr->ts.tv_usec * 1000;
+    if (!cap->num) {
+      first = ts;
+    }
+
+    // Captures are not always in order, never schedule backwards
+    uint64_t offset_ns = (ts > first) ? ts - first : 0;
+    if (cap->num && (offset_ns < cap->datagram[cap->num - 1].offset)) {
+      offset_ns = cap->datagram[cap->num - 1].offset;
+    }
+
+    if (replay_add(cap, offset_ns, port, data, len)) {
+      fprintf(stderr, "Out of memory loading %s\n", filename);
+      pcap_close(pcap);
+      return -1;
+    }
+  }
+
+  if (rc == -1) {
+    fprintf(stderr, "%s: %s\n", filename, pcap_geterr(pcap));
+    pcap_close(pcap);
+    return -1;
+  }
+
+  pcap_close(pcap);
+  return 0;
+}
+
+static int replay_broadcast(const char *name, struct in_addr *addr) {
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if ((fd < 0) || ioctl(fd, SIOCGIFBRDADDR, &ifr)) {
+    perror(name);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  close(fd);
+
+  *addr = ((struct sockaddr_in *)&ifr.ifr_broadaddr)->sin_addr;
+  if (!addr->s_addr) {
+    fprintf(stderr, "%s has no broadcast address\n", name);
+    return -1;
+  }
+  return 0;
+}
+
+static uint64_t replay_metric(const char *line, const char *name) {
+  size_t len = strlen(name);
+  if (strncmp(line, name, len) ||
+      ((line[len] != ' ') && (line[len] != '{'))) {
+    return 0;
+  }
+
+  const char *value = strrchr(line, ' ');
+  return value ? strtoull(value + 1, NULL, 10) : 0;
+}
+
+// Reads the exporter of the collector on its Unix socket
+static int replay_stats(const char *path, struct replay_counters *counters) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((fd < 0) ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    perror(path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  FILE *stream = fdopen(fd, "r");
+  if (!stream) {
+    close(fd);
+    return -1;
+  }
+
+  char line[1024];
+  memset(counters, 0, sizeof(struct replay_counters));
+  while (fgets(line, sizeof(line), stream)) {
+    if (line[0] == '#') {
+      continue;
+    }
+    counters->received += replay_metric(line,
+      "epics_relay_received_packets_total");
+    counters->drops += replay_metric(line, "epics_relay_socket_drops_total");
+    if (strstr(line, "result=\"accept\"")) {
+      counters->accept += replay_metric(line, "epics_relay_filter_total");
+    } else {
+      counters->reject += replay_metric(line, "epics_relay_filter_total");
+    }
+    // Only the total, not the per emitter lines
+    if (!strchr(line, '{')) {
+      counters->sent += replay_metric(line, "epics_relay_sent_packets_total");
+      counters->errors += replay_metric(line,
+        "epics_relay_send_errors_total");
+    }
+  }
+
+  fclose(stream);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *address = NULL;
+  const char *iface = NULL;
+  const char *stats = NULL;
+  double speed = 1.0;
+  int fast = 0;
+  int loops = 1;
+  int wait = 500;
+
+  while (1) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "a:i:x:fl:s:w:", long_options,
+                        &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+    case 'a':
+      address = optarg;
+      break;
+    case 'i':
+      iface = optarg;
+      break;
+    case 'x':
+      speed = atof(optarg);
+      break;
+    case 'f':
+      fast = 1;
+      break;
+    case 'l':
+      loops = atoi(optarg);
+      break;
+    case 's':
+      stats = optarg;
+      break;
+    case 'w':
+      wait = atoi(optarg);
+      break;
+    case '?':
+    default:
+      usage();
+      exit(-1);
+      break;
+    }
+  }
+
+  if ((optind != (argc - 1)) || (!address && !iface) ||
+      (speed <= 0) || (loops < 1) || (wait < 0)) {
+    usage();
+    exit(-1);
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  if (address) {
+    if (!inet_aton(address, &(addr.sin_addr))) {
+      fprintf(stderr, "Invalid address %s\n", address);
+      exit(-1);
+    }
+  } else if (replay_broadcast(iface, &(addr.sin_addr))) {
+    exit(-1);
+  }
+
+  struct replay_capture cap;
+  if (replay_load(argv[optind], &cap)) {
+    exit(-1);
+  }
+  if (!cap.num) {
+    fprintf(stderr, "No CA or PVA datagrams in %s\n", argv[optind]);
+    exit(-1);
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int enable = 1;
+  if ((fd < 0) ||
+      setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable))) {
+    perror("socket");
+    exit(-1);
+  }
+
+  struct replay_counters before;
+  if (stats && replay_stats(stats, &before)) {
+    exit(-1);
+  }
+
+  printf("Replaying %d datagrams (%d packets skipped) over %.3f s "
+         "to %s\n", cap.num, cap.skipped,
+         cap.datagram[cap.num - 1].offset * 1e-9, inet_ntoa(addr.sin_addr));
+
+  uint64_t sent = 0;
+  uint64_t errors = 0;
+  uint64_t late = 0;
+  uint64_t behind = 0;
+  uint64_t start = replay_now();
+  uint64_t loop_start = start;
+
+  for (int i = 0; i < loops; i++) {
+    for (int j = 0; j < cap.num; j++) {
+      struct replay_datagram *datagram = &(cap.datagram[j]);
+
+      if (!fast) {
+        uint64_t target = loop_start + (uint64_t)(datagram->offset / speed);
+        uint64_t now = replay_now();
+        if (now < target) {
+          replay_sleep(target);
+        } else if ((now - target) > behind) {
+          behind = now - target;
+        }
+        if ((now > target) && ((now - target) > REPLAY_LATE_NS)) {
+          late++;
+        }
+      }
+
+      addr.sin_port = htons(datagram->port);
+      if (sendto(fd, cap.payload + datagram->data, datagram->len, 0,
+                 (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        errors++;
+      } else {
+        sent++;
+      }
+    }
+
+    // The next loop starts where this one would have ended
+    loop_start = fast ? replay_now() : loop_start +
+      (uint64_t)(cap.datagram[cap.num - 1].offset / speed);
+  }
+
+  double elapsed = (replay_now() - start) * 1e-9;
+  printf("Sent %lu datagrams in %.3f s, %.0f per second, %lu errors\n",
+         (unsigned long)sent, elapsed, elapsed > 0 ? sent / elapsed : 0,
+         (unsigned long)errors);
+  if (!fast) {
+    printf("Schedule : %lu datagrams more than %d ms late, "
+           "at most %.3f ms behind\n", (unsigned long)late,
+           REPLAY_LATE_NS / 1000000, behind * 1e-6);
+  }
+
+  if (stats) {
+    // Let the relay drain its queues before reading the counters again
+    usleep(wait * 1000);
+
+    struct replay_counters after;
+    if (replay_stats(stats, &after)) {
+      exit(-1);
+    }
+
+    uint64_t received = after.received - before.received;
+    printf("Relay    : received %lu (%.1f %%), socket drops %lu\n",
+           (unsigned long)received, sent ? 100.0 * received / sent : 0,
+           (unsigned long)(after.drops - before.drops));
+    printf("Relay    : filter accepted %lu, rejected %lu\n",
+           (unsigned long)(after.accept - before.accept),
+           (unsigned long)(after.reject - before.reject));
+    printf("Relay    : sent %lu, send errors %lu\n",
+           (unsigned long)(after.sent - before.sent),
+           (unsigned long)(after.errors - before.errors));
+  }
+
+  close(fd);
+  free(cap.datagram);
+  free(cap.payload);
+  return 0;
+}
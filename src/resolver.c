@@ -0,0 +1,126 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "debug.h"
+#include "collector.h"
+#include "resolver.h"
+
+int resolver_lookup(const char *hostname, struct in_addr *addr) {
+  struct addrinfo hints, *res;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  int rc = getaddrinfo(hostname, NULL, &hints, &res);
+  if (rc) {
+    ERROR_PRINT("Unable to resolve %s : %s\n", hostname, gai_strerror(rc));
+    return -1;
+  }
+
+  *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+  freeaddrinfo(res);
+
+  return 0;
+}
+
+static void* resolver_thread(void *arg) {
+  collector_params *params = arg;
+
+  // Lookups block here and never in the receive loop
+  for (;;) {
+    for (int i = 0; i < params->num_fd; i++) {
+      struct in_addr addr;
+      if (!params->hostname[i] ||
+          resolver_lookup(params->hostname[i], &addr)) {
+        // Keep the last address we had
+        continue;
+      }
+
+      in_addr_t old = __atomic_load_n(
+        &(params->emitter_addr[i].sin_addr.s_addr), __ATOMIC_RELAXED);
+      if (old == addr.s_addr) {
+        continue;
+      }
+
+      __atomic_store_n(&(params->emitter_addr[i].sin_addr.s_addr),
+                       addr.s_addr, __ATOMIC_RELAXED);
+      char name[INET_ADDRSTRLEN];
+      if (inet_ntop(AF_INET, &addr, name, sizeof(name))) {
+        NOTICE_PRINT("Emitter %s resolved to %s\n", params->hostname[i],
+                     name);
+      }
+    }
+
+    sleep(params->resolve_interval);
+  }
+
+  return NULL;
+}
+
+int resolver_start(collector_params *params) {
+  pthread_t thread;
+
+  int num_host = 0;
+  for (int i = 0; i < params->num_fd; i++) {
+    if (params->hostname[i]) {
+      num_host++;
+    }
+  }
+
+  if (!num_host) {
+    // Only addresses, nothing to do
+    return 0;
+  }
+
+  if (pthread_create(&thread, NULL, resolver_thread, params)) {
+    ERROR_COMMENT("Unable to start resolver thread\n");
+    return -1;
+  }
+  pthread_detach(thread);
+
+  return 0;
+}
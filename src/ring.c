@@ -0,0 +1,251 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "debug.h"
+#include "ring.h"
+
+#define RING_MAGIC_INIT     0x494E4954  // "INIT"
+
+struct ring_slot {
+  uint32_t len;
+  uint32_t _pad;
+  unsigned char data[];
+};
+
+static int ring_futex(uint32_t *addr, int op, uint32_t val,
+                      const struct timespec *timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static uint32_t ring_stride(uint32_t slot_size) {
+  uint32_t stride = sizeof(struct ring_slot) + slot_size;
+  return (stride + RING_CACHE_LINE - 1) & ~(RING_CACHE_LINE - 1);
+}
+
+static struct ring_slot* ring_slot(struct ring *ring, uint32_t n) {
+  return (struct ring_slot*)(ring->data +
+                             (size_t)(n & (ring->num_slots - 1)) *
+                             ring->stride);
+}
+
+static void ring_init(struct ring *ring, uint32_t num_slots,
+                      uint32_t slot_size) {
+  ring->num_slots = num_slots;
+  ring->slot_size = slot_size;
+  ring->stride = ring_stride(slot_size);
+  ring->head = 0;
+  ring->dropped = 0;
+  ring->tail = 0;
+  ring->waiting = 0;
+}
+
+size_t ring_size(uint32_t num_slots, uint32_t slot_size) {
+  return sizeof(struct ring) + (size_t)num_slots * ring_stride(slot_size);
+}
+
+struct ring* ring_create(uint32_t num_slots, uint32_t slot_size) {
+  if (!num_slots || (num_slots & (num_slots - 1))) {
+    ERROR_PRINT("Ring size %u is not a power of 2\n", num_slots);
+    return NULL;
+  }
+
+  struct ring *ring = aligned_alloc(RING_CACHE_LINE,
+                                    ring_size(num_slots, slot_size));
+  if (ring == NULL) {
+    ERROR_COMMENT("Unable to allocate memory\n");
+    return NULL;
+  }
+
+  ring_init(ring, num_slots, slot_size);
+  ring->magic = RING_MAGIC;
+
+  return ring;
+}
+
+void ring_free(struct ring *ring) {
+  free(ring);
+}
+
+struct ring* ring_shm_open(const char *name, uint32_t num_slots,
+                           uint32_t slot_size) {
+  if (!num_slots || (num_slots & (num_slots - 1))) {
+    ERROR_PRINT("Ring size %u is not a power of 2\n", num_slots);
+    return NULL;
+  }
+
+  size_t size = ring_size(num_slots, slot_size);
+
+  // Either side may start first so both create the segment
+  int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    ERROR_PRINT("Unable to open shared memory %s : %s\n", name,
+                strerror(errno));
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st)) {
+    ERROR_PRINT("Unable to stat shared memory %s\n", name);
+    close(fd);
+    return NULL;
+  }
+
+  if (!st.st_size) {
+    if (ftruncate(fd, size)) {
+      ERROR_PRINT("Unable to size shared memory %s\n", name);
+      close(fd);
+      return NULL;
+    }
+  } else if ((size_t)st.st_size != size) {
+    ERROR_PRINT("Shared memory %s has the wrong size\n", name);
+    close(fd);
+    return NULL;
+  }
+
+  struct ring *ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+  close(fd);
+  if (ring == MAP_FAILED) {
+    ERROR_PRINT("Unable to map shared memory %s\n", name);
+    return NULL;
+  }
+
+  // A new segment is zero filled, the first to claim it sets it up
+  // and an existing ring is reused so a restart keeps the other side
+  uint32_t expected = 0;
+  if (__atomic_compare_exchange_n(&ring->magic, &expected, RING_MAGIC_INIT,
+                                  0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    ring_init(ring, num_slots, slot_size);
+    __atomic_store_n(&ring->magic, RING_MAGIC, __ATOMIC_RELEASE);
+  } else {
+    while (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) ==
+           RING_MAGIC_INIT) {
+      usleep(1000);
+    }
+  }
+
+  if ((ring->magic != RING_MAGIC) || (ring->num_slots != num_slots) ||
+      (ring->slot_size != slot_size)) {
+    ERROR_PRINT("Shared memory %s is not a matching ring\n", name);
+    munmap(ring, size);
+    return NULL;
+  }
+
+  return ring;
+}
+
+void ring_shm_close(struct ring *ring) {
+  munmap(ring, ring_size(ring->num_slots, ring->slot_size));
+}
+
+void* ring_reserve(struct ring *ring) {
+  // Only the producer writes head
+  uint32_t head = ring->head;
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+  if ((head - tail) >= ring->num_slots) {
+    __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  return ring_slot(ring, head)->data;
+}
+
+void ring_commit(struct ring *ring, uint32_t len) {
+  uint32_t head = ring->head;
+  ring_slot(ring, head)->len = len;
+
+  // Publish, then wake the consumer only if it went to sleep
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)) {
+    ring_futex(&ring->head, FUTEX_WAKE, INT_MAX, NULL);
+  }
+}
+
+const void* ring_peek(struct ring *ring, uint32_t *len) {
+  // Only the consumer writes tail
+  uint32_t tail = ring->tail;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  if (head == tail) {
+    return NULL;
+  }
+
+  struct ring_slot *slot = ring_slot(ring, tail);
+  *len = slot->len;
+  return slot->data;
+}
+
+void ring_release(struct ring *ring) {
+  __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+int ring_wait(struct ring *ring, const struct timespec *timeout) {
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (head != ring->tail) {
+    return 0;
+  }
+
+  // Say we are waiting then check again so a commit is never missed
+  __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+  head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+  if (head == ring->tail) {
+    ring_futex(&ring->head, FUTEX_WAIT, head, timeout);
+  }
+  __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+
+  return (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) ?
+    0 : -1;
+}
+
+uint32_t ring_depth(struct ring *ring) {
+  // Read from any thread, for monitoring only
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+}
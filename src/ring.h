@@ -0,0 +1,81 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef SRC_RING_H_
+#define SRC_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define RING_MAGIC          0x52494E47  // "RING"
+#define RING_CACHE_LINE     64
+#define RING_SLOTS          256         // Default, must be a power of 2
+
+// Single producer single consumer ring of fixed size slots. The ring
+// is position independent so it can live in a shared memory segment
+// between two processes. head and tail are free running counters, the
+// consumer sleeps on a futex on head and is only woken by the producer
+// when it has said it is waiting.
+
+struct ring {
+  uint32_t magic;
+  uint32_t num_slots;
+  uint32_t slot_size;
+  uint32_t stride;
+  uint32_t head __attribute__((aligned(RING_CACHE_LINE)));
+  uint32_t dropped;
+  uint32_t tail __attribute__((aligned(RING_CACHE_LINE)));
+  uint32_t waiting;
+  unsigned char data[] __attribute__((aligned(RING_CACHE_LINE)));
+};
+
+size_t ring_size(uint32_t num_slots, uint32_t slot_size);
+struct ring* ring_create(uint32_t num_slots, uint32_t slot_size);
+void ring_free(struct ring *ring);
+struct ring* ring_shm_open(const char *name, uint32_t num_slots,
+                           uint32_t slot_size);
+void ring_shm_close(struct ring *ring);
+void* ring_reserve(struct ring *ring);
+void ring_commit(struct ring *ring, uint32_t len);
+const void* ring_peek(struct ring *ring, uint32_t *len);
+void ring_release(struct ring *ring);
+int ring_wait(struct ring *ring, const struct timespec *timeout);
+uint32_t ring_depth(struct ring *ring);
+
+#endif  // SRC_RING_H_
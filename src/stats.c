@@ -0,0 +1,571 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "debug.h"
+#include "ethernet.h"
+#include "epics.h"
+#include "ring.h"
+#include "stats.h"
+
+_Thread_local struct stats_block *stats_local = NULL;
+
+// All blocks ever registered, threads live as long as the process
+static struct stats_block *stats_head = NULL;
+static struct stats_block stats_fallback;
+
+static const char *stats_stage[] = {"parse", "send", "broadcast"};
+static const double stats_quantile[] = {50.0, 90.0, 99.0, 99.9};
+#define STATS_NUM_QUANTILE 4
+
+// Receive sockets, registered during setup
+static struct stats_socket stats_sockets[STATS_MAX_SOCKET];
+static int stats_num_socket = 0;
+
+// Pipeline rings and threads, registered during setup
+static struct stats_queue stats_queues[STATS_MAX_QUEUE];
+static int stats_num_queue = 0;
+static struct stats_worker stats_workers[STATS_MAX_WORKER];
+static int stats_num_worker = 0;
+
+// Listen ports in the order of the STATS_RX_ counters
+static const int stats_port[] = {
+  EPICS_CA_SERVER_PORT, EPICS_CA_REPEATER_PORT, EPICS_PVA_BROADCAST_PORT
+};
+
+struct stats_block* stats_register(void) {
+  struct stats_block *block = aligned_alloc(STATS_CACHE_LINE,
+                                            sizeof(struct stats_block));
+  if (block == NULL) {
+    // Counts from threads which fail here are not exact
+    ERROR_COMMENT("Unable to allocate memory\n");
+    stats_local = &stats_fallback;
+    return stats_local;
+  }
+
+  memset(block, 0, sizeof(struct stats_block));
+  block->next = __atomic_load_n(&stats_head, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&stats_head, &(block->next), block, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+
+  stats_local = block;
+  return block;
+}
+
+struct stats_socket* stats_socket(const char *name,
+                                  struct stats_config *config) {
+  if (stats_num_socket >= STATS_MAX_SOCKET) {
+    ERROR_PRINT("Drops on %s will not be counted\n", name);
+    return NULL;
+  }
+
+  struct stats_socket *sock = &(stats_sockets[stats_num_socket]);
+  memset(sock, 0, sizeof(struct stats_socket));
+  strncpy(sock->name, name, sizeof(sock->name) - 1);
+  sock->rcvbuf = config->rcvbuf;
+  sock->rcvbuf_max = config->rcvbuf_max;
+
+  // Publish only once the entry is filled in
+  __atomic_store_n(&stats_num_socket, stats_num_socket + 1,
+                   __ATOMIC_RELEASE);
+  return sock;
+}
+
+struct stats_queue* stats_queue(const char *name, struct ring *ring) {
+  if (stats_num_queue >= STATS_MAX_QUEUE) {
+    ERROR_PRINT("Depth of %s will not be exported\n", name);
+    return NULL;
+  }
+
+  struct stats_queue *queue = &(stats_queues[stats_num_queue]);
+  memset(queue, 0, sizeof(struct stats_queue));
+  strncpy(queue->name, name, sizeof(queue->name) - 1);
+  queue->ring = ring;
+
+  __atomic_store_n(&stats_num_queue, stats_num_queue + 1, __ATOMIC_RELEASE);
+  return queue;
+}
+
+struct stats_worker* stats_worker(const char *name) {
+  if (stats_num_worker >= STATS_MAX_WORKER) {
+    ERROR_PRINT("Utilization of %s will not be exported\n", name);
+    return NULL;
+  }
+
+  struct stats_worker *worker = &(stats_workers[stats_num_worker]);
+  memset(worker, 0, sizeof(struct stats_worker));
+  strncpy(worker->name, name, sizeof(worker->name) - 1);
+
+  __atomic_store_n(&stats_num_worker, stats_num_worker + 1,
+                   __ATOMIC_RELEASE);
+  return worker;
+}
+
+void stats_socket_open(struct stats_socket *sock, int fd) {
+  if (!sock) {
+    return;
+  }
+
+  // A new socket starts counting from zero and keeps any grown buffer
+  sock->seen = 0;
+  int size = set_rcvbuf(fd, sock->rcvbuf);
+  if (size > 0) {
+    __atomic_store_n(&(sock->rcvbuf), size, __ATOMIC_RELAXED);
+  }
+}
+
+static void stats_socket_grow(struct stats_socket *sock, int fd) {
+  int size = sock->rcvbuf * 2;
+  if (size > sock->rcvbuf_max) {
+    size = sock->rcvbuf_max;
+  }
+  if (size <= sock->rcvbuf) {
+    return;
+  }
+
+  int actual = set_rcvbuf(fd, size);
+  if (actual <= sock->rcvbuf) {
+    // Without CAP_NET_ADMIN the kernel caps us at rmem_max
+    ERROR_PRINT("Unable to grow receive buffer of %s past %d bytes\n",
+                sock->name, sock->rcvbuf);
+    sock->rcvbuf_max = sock->rcvbuf;
+    return;
+  }
+
+  NOTICE_PRINT("Receive buffer of %s grown to %d bytes after drops\n",
+               sock->name, actual);
+  __atomic_store_n(&(sock->rcvbuf), actual, __ATOMIC_RELAXED);
+}
+
+void stats_socket_drops(struct stats_socket *sock, int fd, uint32_t count,
+                        const struct timespec *ts) {
+  // Unsigned difference also holds when the kernel count wraps
+  stats_add(&(sock->drops), (uint32_t)(count - sock->seen));
+  sock->seen = count;
+
+  if (!sock->rcvbuf_max || (ts->tv_sec == sock->window)) {
+    return;
+  }
+
+  // Grow the buffer only when drops are seen in consecutive seconds
+  sock->streak = (ts->tv_sec == sock->window + 1) ? sock->streak + 1 : 1;
+  sock->window = ts->tv_sec;
+  if (sock->streak >= STATS_DROP_SECONDS) {
+    stats_socket_grow(sock, fd);
+    sock->streak = 0;
+  }
+}
+
+static void stats_sum_block(struct stats_block *total,
+                            struct stats_block *block) {
+  uint64_t *dst = (uint64_t *)total;
+  uint64_t *src = (uint64_t *)block;
+  int num = offsetof(struct stats_block, next) / sizeof(uint64_t);
+
+  for (int i = 0; i < num; i++) {
+    dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+  }
+}
+
+void stats_sum(struct stats_block *total) {
+  memset(total, 0, sizeof(struct stats_block));
+
+  stats_sum_block(total, &stats_fallback);
+  for (struct stats_block *block = __atomic_load_n(&stats_head,
+                                                   __ATOMIC_ACQUIRE);
+       block; block = block->next) {
+    stats_sum_block(total, block);
+  }
+}
+
+void stats_write(FILE *out) {
+  struct stats_block total;
+  stats_sum(&total);
+
+  fprintf(out, "# TYPE epics_relay_received_packets_total counter\n");
+  for (int i = 0; i < 3; i++) {
+    fprintf(out, "epics_relay_received_packets_total{port=\"%d\"} %lu\n",
+            stats_port[i],
+            (unsigned long)total.counter[STATS_RX_CA_SERVER + i]);
+  }
+
+  fprintf(out, "# TYPE epics_relay_frames_total counter\n");
+  for (int i = 0; i < STATS_MAX_CMD; i++) {
+    if (total.cmd[i]) {
+      fprintf(out, "epics_relay_frames_total{command=\"%d\"} %lu\n",
+              i, (unsigned long)total.cmd[i]);
+    }
+  }
+  fprintf(out, "epics_relay_frames_total{command=\"pva\"} %lu\n",
+          (unsigned long)total.counter[STATS_FRAME_PVA]);
+
+  fprintf(out, "# TYPE epics_relay_filter_total counter\n");
+  fprintf(out, "epics_relay_filter_total{result=\"accept\"} %lu\n",
+          (unsigned long)total.counter[STATS_FILTER_ACCEPT]);
+  fprintf(out, "epics_relay_filter_total{result=\"reject\"} %lu\n",
+          (unsigned long)total.counter[STATS_FILTER_REJECT]);
+
+  fprintf(out, "# TYPE epics_relay_sent_packets_total counter\n");
+  fprintf(out, "epics_relay_sent_packets_total %lu\n",
+          (unsigned long)total.counter[STATS_SEND_OK]);
+  for (int i = 0; i < STATS_MAX_DEST; i++) {
+    if (total.send_ok[i]) {
+      fprintf(out, "epics_relay_sent_packets_total{emitter=\"%d\"} %lu\n",
+              i, (unsigned long)total.send_ok[i]);
+    }
+  }
+
+  fprintf(out, "# TYPE epics_relay_send_errors_total counter\n");
+  fprintf(out, "epics_relay_send_errors_total %lu\n",
+          (unsigned long)total.counter[STATS_SEND_FAIL]);
+  for (int i = 0; i < STATS_MAX_DEST; i++) {
+    if (total.send_fail[i]) {
+      fprintf(out, "epics_relay_send_errors_total{emitter=\"%d\"} %lu\n",
+              i, (unsigned long)total.send_fail[i]);
+    }
+  }
+
+  fprintf(out, "# TYPE epics_relay_emitter_received_packets_total counter\n");
+  fprintf(out, "epics_relay_emitter_received_packets_total %lu\n",
+          (unsigned long)total.counter[STATS_EMITTER_RX]);
+  fprintf(out, "# TYPE epics_relay_broadcast_packets_total counter\n");
+  fprintf(out, "epics_relay_broadcast_packets_total %lu\n",
+          (unsigned long)total.counter[STATS_EMITTER_BCAST]);
+  fprintf(out, "# TYPE epics_relay_rejected_packets_total counter\n");
+  fprintf(out, "epics_relay_rejected_packets_total %lu\n",
+          (unsigned long)total.counter[STATS_EMITTER_REJECT]);
+
+  int num = __atomic_load_n(&stats_num_socket, __ATOMIC_ACQUIRE);
+  fprintf(out, "# TYPE epics_relay_socket_drops_total counter\n");
+  for (int i = 0; i < num; i++) {
+    fprintf(out, "epics_relay_socket_drops_total{socket=\"%s\"} %lu\n",
+            stats_sockets[i].name, (unsigned long)__atomic_load_n(
+              &(stats_sockets[i].drops), __ATOMIC_RELAXED));
+  }
+  fprintf(out, "# TYPE epics_relay_socket_rcvbuf_bytes gauge\n");
+  for (int i = 0; i < num; i++) {
+    fprintf(out, "epics_relay_socket_rcvbuf_bytes{socket=\"%s\"} %d\n",
+            stats_sockets[i].name, __atomic_load_n(
+              &(stats_sockets[i].rcvbuf), __ATOMIC_RELAXED));
+  }
+
+  // Only the pipelined collector has queues
+  num = __atomic_load_n(&stats_num_queue, __ATOMIC_ACQUIRE);
+  if (num) {
+    fprintf(out, "# TYPE epics_relay_queue_depth gauge\n");
+    for (int i = 0; i < num; i++) {
+      fprintf(out, "epics_relay_queue_depth{queue=\"%s\"} %u\n",
+              stats_queues[i].name, ring_depth(stats_queues[i].ring));
+    }
+    fprintf(out, "# TYPE epics_relay_queue_slots gauge\n");
+    for (int i = 0; i < num; i++) {
+      fprintf(out, "epics_relay_queue_slots{queue=\"%s\"} %u\n",
+              stats_queues[i].name, stats_queues[i].ring->num_slots);
+    }
+    fprintf(out, "# TYPE epics_relay_queue_drops_total counter\n");
+    for (int i = 0; i < num; i++) {
+      fprintf(out, "epics_relay_queue_drops_total{queue=\"%s\"} %u\n",
+              stats_queues[i].name, __atomic_load_n(
+                &(stats_queues[i].ring->dropped), __ATOMIC_RELAXED));
+    }
+  }
+
+  num = __atomic_load_n(&stats_num_worker, __ATOMIC_ACQUIRE);
+  if (num) {
+    fprintf(out, "# TYPE epics_relay_worker_busy_seconds_total counter\n");
+    for (int i = 0; i < num; i++) {
+      fprintf(out, "epics_relay_worker_busy_seconds_total{worker=\"%s\"} "
+              "%.6f\n", stats_workers[i].name, __atomic_load_n(
+                &(stats_workers[i].busy), __ATOMIC_RELAXED) * 1e-9);
+    }
+  }
+
+  fprintf(out, "# TYPE epics_relay_latency_seconds summary\n");
+  for (int i = 0; i < STATS_LATENCY_NUM; i++) {
+    struct histogram *hist = &(total.latency[i]);
+    if (!hist->count) {
+      continue;
+    }
+    for (int j = 0; j < STATS_NUM_QUANTILE; j++) {
+      fprintf(out, "epics_relay_latency_seconds{stage=\"%s\","
+              "quantile=\"%g\"} %.9f\n", stats_stage[i],
+              stats_quantile[j] / 100.0,
+              histogram_percentile(hist, stats_quantile[j]) * 1e-9);
+    }
+    fprintf(out, "epics_relay_latency_seconds_sum{stage=\"%s\"} %.9f\n",
+            stats_stage[i], hist->sum * 1e-9);
+    fprintf(out, "epics_relay_latency_seconds_count{stage=\"%s\"} %lu\n",
+            stats_stage[i], (unsigned long)hist->count);
+  }
+}
+
+void stats_dump(void) {
+  struct stats_block total;
+  stats_sum(&total);
+
+  for (int i = 0; i < STATS_LATENCY_NUM; i++) {
+    struct histogram *hist = &(total.latency[i]);
+    if (!hist->count) {
+      continue;
+    }
+    NOTICE_PRINT("Latency %-9s : %lu packets, p50 %.1f us, p90 %.1f us, "
+                 "p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+                 stats_stage[i], (unsigned long)hist->count,
+                 histogram_percentile(hist, 50.0) * 1e-3,
+                 histogram_percentile(hist, 90.0) * 1e-3,
+                 histogram_percentile(hist, 99.0) * 1e-3,
+                 histogram_percentile(hist, 99.9) * 1e-3,
+                 histogram_max(hist) * 1e-3);
+  }
+}
+
+static void stats_reply(int fd, const char *text, size_t len) {
+  while (len) {
+    // A client gone before the reply is dropped (EPIPE), never SIGPIPE
+    ssize_t sent = send(fd, text, len, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      DEBUG_PRINT("Stats client dropped : %s\n", strerror(errno));
+      return;
+    }
+    text += sent;
+    len -= sent;
+  }
+}
+
+static void stats_serve(int fd, int http) {
+  // Do not let a stalled client hold up the exporter
+  struct timeval timeout = {STATS_TIMEOUT, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  if (http) {
+    // Any request gets the metrics, read up to the blank line. A socket
+    // can not be repositioned, so the request is read through its own
+    // stream and the reply sent on the socket
+    int _fd = dup(fd);
+    FILE *in = (_fd >= 0) ? fdopen(_fd, "r") : NULL;
+    if (!in) {
+      if (_fd >= 0) {
+        close(_fd);
+      }
+      close(fd);
+      return;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), in)) {
+      if (!strcmp(line, "\r\n") || !strcmp(line, "\n")) {
+        break;
+      }
+    }
+    fclose(in);
+  }
+
+  char *text = NULL;
+  size_t len = 0;
+  FILE *out = open_memstream(&text, &len);
+  if (out) {
+    if (http) {
+      fprintf(out, "HTTP/1.0 200 OK\r\n"
+              "Content-Type: text/plain; version=0.0.4\r\n"
+              "Connection: close\r\n\r\n");
+    }
+    stats_write(out);
+    if (!fclose(out)) {
+      stats_reply(fd, text, len);
+    }
+    free(text);
+  }
+
+  close(fd);
+}
+
+struct stats_exporter {
+  int fd_http;
+  int fd_unix;
+};
+
+static void* stats_thread(void *arg) {
+  struct stats_exporter *exporter = arg;
+  fd_set socks;
+
+  for (;;) {
+    FD_ZERO(&socks);
+    int maxfd = -1;
+    if (exporter->fd_http >= 0) {
+      FD_SET(exporter->fd_http, &socks);
+      maxfd = (exporter->fd_http > maxfd) ? exporter->fd_http : maxfd;
+    }
+    if (exporter->fd_unix >= 0) {
+      FD_SET(exporter->fd_unix, &socks);
+      maxfd = (exporter->fd_unix > maxfd) ? exporter->fd_unix : maxfd;
+    }
+
+    if (select(maxfd + 1, &socks, NULL, NULL, NULL) < 0) {
+      continue;
+    }
+
+    if ((exporter->fd_http >= 0) && FD_ISSET(exporter->fd_http, &socks)) {
+      int fd = accept(exporter->fd_http, NULL, NULL);
+      if (fd >= 0) {
+        stats_serve(fd, 1);
+      }
+    }
+
+    if ((exporter->fd_unix >= 0) && FD_ISSET(exporter->fd_unix, &socks)) {
+      int fd = accept(exporter->fd_unix, NULL, NULL);
+      if (fd >= 0) {
+        stats_serve(fd, 0);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static int stats_listen_http(struct stats_config *config) {
+  struct sockaddr_in addr;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config->port);
+  if (!inet_aton(config->address, &(addr.sin_addr))) {
+    ERROR_PRINT("Invalid stats address %s\n", config->address);
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    ERROR_COMMENT("Unable to create stats socket\n");
+    return -1;
+  }
+
+  int enable = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 4)) {
+    ERROR_PRINT("Unable to bind stats to %s:%d : %s\n", config->address,
+                config->port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int stats_listen_unix(struct stats_config *config) {
+  struct sockaddr_un addr;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(config->path) >= sizeof(addr.sun_path)) {
+    ERROR_PRINT("Stats socket path too long : %s\n", config->path);
+    return -1;
+  }
+  strncpy(addr.sun_path, config->path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    ERROR_COMMENT("Unable to create stats socket\n");
+    return -1;
+  }
+
+  // Remove a socket left by a previous run
+  unlink(config->path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 4)) {
+    ERROR_PRINT("Unable to bind stats socket %s : %s\n", config->path,
+                strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int stats_start(struct stats_config *config) {
+  static struct stats_exporter exporter;
+  pthread_t thread;
+
+  exporter.fd_http = -1;
+  exporter.fd_unix = -1;
+
+  if (config->port) {
+    if ((exporter.fd_http = stats_listen_http(config)) < 0) {
+      return -1;
+    }
+    NOTICE_PRINT("Serving stats on http://%s:%d/metrics\n",
+                 config->address, config->port);
+  }
+
+  if (config->path[0]) {
+    if ((exporter.fd_unix = stats_listen_unix(config)) < 0) {
+      return -1;
+    }
+    NOTICE_PRINT("Serving stats on %s\n", config->path);
+  }
+
+  if ((exporter.fd_http < 0) && (exporter.fd_unix < 0)) {
+    // Not configured
+    return 0;
+  }
+
+  if (pthread_create(&thread, NULL, stats_thread, &exporter)) {
+    ERROR_COMMENT("Unable to start stats thread\n");
+    return -1;
+  }
+  pthread_detach(thread);
+
+  return 0;
+}
@@ -0,0 +1,214 @@
+//
+//  epics-relay
+//
+//  Stuart B. Wilkins, Brookhaven National Laboratory
+//
+//
+//  BSD 3-Clause License
+//
+//  Copyright (c) 2021, Brookhaven Science Associates
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its
+//     contributors may be used to endorse or promote products derived from
+//     this software without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+//  THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef SRC_STATS_H_
+#define SRC_STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "histogram.h"
+
+#define STATS_CACHE_LINE      64
+#define STATS_MAX_CMD         32    // CA commands counted by number
+#define STATS_MAX_DEST        64    // Emitters counted individually
+#define STATS_MAX_SOCKET      64    // Receive sockets with drop counts
+#define STATS_MAX_QUEUE       64    // Pipeline rings with depth gauges
+#define STATS_MAX_WORKER      64    // Pipeline threads with busy time
+#define STATS_RCVBUF_MAX      (4 * 1024 * 1024)
+#define STATS_DROP_SECONDS    3     // Seconds of drops before growing
+#define STATS_TIMEOUT         1     // Seconds a client may stall a scrape
+
+// Counters are kept per thread, each thread only ever writes its own
+// block so recording is a plain load and store. Blocks are cache line
+// aligned so threads never share a line, and are only summed up when
+// the exporter is scraped.
+
+enum stats_counter {
+  STATS_RX_CA_SERVER = 0,     // Received on the listen ports, in the
+  STATS_RX_CA_REPEATER,       // order of listen_ports
+  STATS_RX_PVA,
+  STATS_FRAME_PVA,
+  STATS_FILTER_ACCEPT,
+  STATS_FILTER_REJECT,
+  STATS_SEND_OK,
+  STATS_SEND_FAIL,
+  STATS_EMITTER_RX,
+  STATS_EMITTER_BCAST,
+  STATS_EMITTER_REJECT,
+  STATS_NUM
+};
+
+// Latency from the kernel receive timestamp of a packet
+enum stats_latency {
+  STATS_LATENCY_PARSE = 0,    // Collector or hub, parse done
+  STATS_LATENCY_SEND,         // Collector, sent to the last emitter
+  STATS_LATENCY_BCAST,        // Emitter or hub, broadcast written
+  STATS_LATENCY_NUM
+};
+
+struct stats_block {
+  uint64_t counter[STATS_NUM];
+  uint64_t cmd[STATS_MAX_CMD];
+  uint64_t send_ok[STATS_MAX_DEST];
+  uint64_t send_fail[STATS_MAX_DEST];
+  struct histogram latency[STATS_LATENCY_NUM];
+  struct stats_block *next;
+} __attribute__((aligned(STATS_CACHE_LINE)));
+
+struct stats_config {
+  char address[64];           // HTTP listen address
+  int port;                   // HTTP port, 0 for none
+  char path[108];             // Unix socket, empty for none
+  int rcvbuf;                 // Initial receive buffer, 0 for default
+  int rcvbuf_max;             // Receive buffer limit, 0 to never grow
+};
+
+// Kernel drops on one receive socket. Only the thread receiving on the
+// socket writes to it, the exporter just reads drops and rcvbuf.
+struct stats_socket {
+  char name[64];
+  uint64_t drops;
+  int rcvbuf;
+  int rcvbuf_max;
+  uint32_t seen;              // Kernel count at the last receive
+  time_t window;              // Last second with drops
+  int streak;                 // Consecutive seconds with drops
+};
+
+struct ring;
+
+// A ring between two pipeline stages, the exporter reads its depth and
+// drops straight from the ring.
+struct stats_queue {
+  char name[64];
+  struct ring *ring;
+};
+
+// Time a pipeline thread spends working rather than waiting. Only the
+// thread writes busy, the exporter reads it.
+struct stats_worker {
+  char name[64];
+  uint64_t busy;              // ns
+};
+
+extern _Thread_local struct stats_block *stats_local;
+struct stats_block* stats_register(void);
+
+static inline struct stats_block* stats_block(void) {
+  struct stats_block *block = stats_local;
+  if (__builtin_expect(block == NULL, 0)) {
+    block = stats_register();
+  }
+  return block;
+}
+
+static inline void stats_add(uint64_t *counter, uint64_t n) {
+  // Single writer, the store only has to be untorn for the reader
+  __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_inc(enum stats_counter counter) {
+  stats_add(&(stats_block()->counter[counter]), 1);
+}
+
+static inline void stats_cmd(unsigned int cmd) {
+  if (cmd < STATS_MAX_CMD) {
+    stats_add(&(stats_block()->cmd[cmd]), 1);
+  }
+}
+
+static inline void stats_send(int dest, int ok) {
+  struct stats_block *block = stats_block();
+  stats_add(&(block->counter[ok ? STATS_SEND_OK : STATS_SEND_FAIL]), 1);
+  if (dest < STATS_MAX_DEST) {
+    stats_add(ok ? &(block->send_ok[dest]) : &(block->send_fail[dest]), 1);
+  }
+}
+
+static inline void stats_latency(enum stats_latency stage,
+                                 const struct timespec *start) {
+  struct timespec now;
+  if (!start->tv_sec || clock_gettime(CLOCK_REALTIME, &now)) {
+    return;
+  }
+
+  int64_t ns = (int64_t)(now.tv_sec - start->tv_sec) * 1000000000 +
+    (now.tv_nsec - start->tv_nsec);
+  if (ns >= 0) {
+    histogram_record(&(stats_block()->latency[stage]), ns);
+  }
+}
+
+void stats_socket_drops(struct stats_socket *sock, int fd, uint32_t count,
+                        const struct timespec *ts);
+
+static inline void stats_drops(struct stats_socket *sock, int fd,
+                               uint32_t count, const struct timespec *ts) {
+  // The count is per socket and only changes when packets are lost
+  if (sock && (count != sock->seen)) {
+    stats_socket_drops(sock, fd, count, ts);
+  }
+}
+
+static inline void stats_busy(struct stats_worker *worker,
+                              const struct timespec *start) {
+  struct timespec now;
+  if (!worker || clock_gettime(CLOCK_MONOTONIC, &now)) {
+    return;
+  }
+
+  int64_t ns = (int64_t)(now.tv_sec - start->tv_sec) * 1000000000 +
+    (now.tv_nsec - start->tv_nsec);
+  if (ns > 0) {
+    stats_add(&(worker->busy), ns);
+  }
+}
+
+struct stats_socket* stats_socket(const char *name,
+                                  struct stats_config *config);
+struct stats_queue* stats_queue(const char *name, struct ring *ring);
+struct stats_worker* stats_worker(const char *name);
+void stats_socket_open(struct stats_socket *sock, int fd);
+void stats_sum(struct stats_block *total);
+void stats_write(FILE *out);
+void stats_dump(void);
+int stats_start(struct stats_config *config);
+
+#endif  // SRC_STATS_H_
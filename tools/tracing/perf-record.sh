@@ -0,0 +1,62 @@
+#!/bin/bash
+#
+#  epics-relay
+#
+#  Stuart B. Wilkins, Brookhaven National Laboratory
+#
+#
+#  BSD 3-Clause License
+#
+#  Copyright (c) 2021, Brookhaven Science Associates
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#
+#  1. Redistributions of source code must retain the above copyright notice,
+#     this list of conditions and the following disclaimer.
+#
+#  2. Redistributions in binary form must reproduce the above copyright notice,
+#     this list of conditions and the following disclaimer in the documentation
+#     and/or other materials provided with the distribution.
+#
+#  3. Neither the name of the copyright holder nor the names of its
+#     contributors may be used to endorse or promote products derived from
+#     this software without specific prior written permission.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+#  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+#  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+#  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+#  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+#  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+#  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+#  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+#  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+#  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+#  THE POSSIBILITY OF SUCH DAMAGE.
+#
+# Record the epics_relay probes of a running daemon with perf
+#
+# Usage: perf-record.sh <pid> [seconds]
+
+set -e
+
+PID=$1
+SECONDS_TO_RECORD=${2:-10}
+BINARY=$(readlink -f "/proc/${PID}/exe")
+
+if [ -z "${PID}" ] || [ ! -x "${BINARY}" ]; then
+  echo "Usage: $0 <pid> [seconds]" >&2
+  exit 1
+fi
+
+# Make the SDT notes of the binary known to perf
+perf buildid-cache --add "${BINARY}"
+for probe in receive frame filter send emitter_receive broadcast; do
+  perf probe -x "${BINARY}" -a "sdt_epics_relay:${probe}" 2>/dev/null || true
+done
+
+perf record -e 'sdt_epics_relay:*' -p "${PID}" -o epics-relay.perf.data \
+  -- sleep "${SECONDS_TO_RECORD}"
+perf script -i epics-relay.perf.data